@@ -0,0 +1,160 @@
+Import("env")
+
+import json
+import os
+
+# path to the config to bake in, relative to the project dir, e.g.
+#   custom_baked_config = scripts/baked_config.example.json
+config_path = env.GetProjectOption("custom_baked_config", "")
+
+INPUT_TYPES = {
+    "button": "BUTTON",
+    "contact": "CONTACT",
+    "press": "PRESS",
+    "rotary": "ROTARY",
+    "security": "SECURITY",
+    "switch": "SWITCH",
+    "toggle": "TOGGLE",
+}
+
+EVENT_TOPIC_LAYOUTS = {
+    "status": "EVENT_TOPIC_STATUS",
+    "type": "EVENT_TOPIC_TYPE",
+    "event": "EVENT_TOPIC_EVENT",
+}
+
+HASS_ENTITIES = {
+    "none": "HASS_ENTITY_NONE",
+    "switch": "HASS_ENTITY_SWITCH",
+    "light": "HASS_ENTITY_LIGHT",
+}
+
+# must match the InputTiming units in src/main.cpp
+INPUT_HOLD_UNIT_MS = 100
+INPUT_CLICK_UNIT_MS = 10
+
+def fail(message):
+    print("Baked config error: %s" % message)
+    env.Exit(1)
+
+def address(value, delimiter, macro):
+    # empty means not configured
+    if not value:
+        return "0"
+
+    parts = value.split(delimiter)
+    if len(parts) != 3 or not all(part.isdigit() for part in parts):
+        fail("invalid address '%s'" % value)
+
+    return "%s(%s)" % (macro, ", ".join(parts))
+
+def lookup(table, value, name):
+    if value not in table:
+        fail("invalid %s '%s'" % (name, value))
+
+    return table[value]
+
+def secure_key(keys, value):
+    # empty key means plain telegrams
+    if not value:
+        return 0
+
+    try:
+        key = bytes.fromhex(value)
+    except ValueError:
+        key = b""
+
+    if len(key) != 16:
+        fail("invalid secure key '%s'" % value)
+
+    # inputs refer to keys by their 1-based position in the table
+    if key not in keys:
+        keys.append(key)
+
+    return keys.index(key) + 1
+
+def timing(input, key, unit):
+    # anything under one unit is still custom timing (0 means the default)
+    ms = int(input.get(key, 0))
+    return 0 if ms == 0 else max(min(ms // unit, 255), 1)
+
+def generate(config, source):
+    keys = []
+    inputs = []
+
+    for input in config.get("inputs", []):
+        if "index" not in input:
+            fail("input missing index")
+
+        inputs.append("  { %3d, %-8s, %-5s, %-5s, { %3d, %3d, %3d }, %-17s, %-17s, %-5s, %5d, %4d, %2d, %-18s }," % (
+            input["index"],
+            lookup(INPUT_TYPES, input.get("type", config.get("defaultInputType", "switch")), "input type"),
+            str(input.get("invert", False)).lower(),
+            str(input.get("disabled", False)).lower(),
+            timing(input, "debounceMs", 1),
+            timing(input, "holdMs", INPUT_HOLD_UNIT_MS),
+            timing(input, "multiClickMs", INPUT_CLICK_UNIT_MS),
+            address(input.get("knxCommandAddress"), "/", "KNX_GA"),
+            address(input.get("knxStateAddress"), "/", "KNX_GA"),
+            str(input.get("knxFailoverOnly", False)).lower(),
+            input.get("knxVerifyMs", 0),
+            input.get("knxReadProxyMs", 0),
+            secure_key(keys, input.get("knxSecureKey")),
+            lookup(HASS_ENTITIES, input.get("knxEntity", "none"), "KNX entity"),
+        ))
+
+    lines = [
+        "// Generated by scripts/baked_config.py from %s, do not edit" % source,
+        "#ifndef BAKED_CONFIG_H",
+        "#define BAKED_CONFIG_H",
+        "",
+        "#define BAKED_KNX_DEVICE_ADDRESS      %s" % address(config.get("knxDeviceAddress"), ".", "KNX_IA"),
+        "#define BAKED_DEFAULT_INPUT_TYPE      %s" % lookup(INPUT_TYPES, config.get("defaultInputType", "switch"), "input type"),
+        "#define BAKED_EVENT_TOPIC_LAYOUT      %s" % lookup(EVENT_TOPIC_LAYOUTS, config.get("eventTopicLayout", "status"), "event topic layout"),
+        "#define BAKED_KNX_POWER_ON_BROADCAST  %s" % str(config.get("knxPowerOnBroadcast", False)).lower(),
+        "#define BAKED_KNX_READ_PROXY_MAX_AGE_MS  %d" % config.get("knxReadProxyMaxAgeMs", 60000),
+        "",
+        "constexpr uint8_t BAKED_SECURE_KEY_COUNT = %d;" % len(keys),
+        "constexpr uint8_t BAKED_SECURE_KEYS[][KNX_SECURE_KEY_LENGTH] = {",
+    ]
+
+    # zero sized arrays aren't allowed, the counts say what is valid
+    for key in keys or [bytes(16)]:
+        lines.append("  { %s }," % ", ".join("0x%02x" % b for b in key))
+
+    lines += [
+        "};",
+        "",
+        "// index, type, invert, disabled, { debounce, hold, click }, command address,",
+        "// state address, failover only, verify ms, read proxy ms, secure key, HA entity",
+        "constexpr uint8_t BAKED_INPUT_COUNT = %d;" % len(inputs),
+        "constexpr BakedInput BAKED_INPUTS[] = {",
+    ]
+    lines += inputs or ["  { 0 },"]
+    lines += [
+        "};",
+        "",
+        "#endif",
+        "",
+    ]
+
+    return "\n".join(lines)
+
+if config_path:
+    source = os.path.join(env.subst("$PROJECT_DIR"), config_path)
+    print("Baked Config: %s" % source)
+
+    with open(source) as file:
+        config = json.load(file)
+
+    # generate into the build dir so nothing generated ends up in src/
+    generated_dir = os.path.join(env.subst("$BUILD_DIR"), "generated")
+    os.makedirs(generated_dir, exist_ok=True)
+
+    with open(os.path.join(generated_dir, "BakedConfig.h"), "w") as file:
+        file.write(generate(config, config_path))
+
+    env.Append(
+        CPPPATH=[generated_dir],
+        CPPDEFINES=["BAKED_CONFIG"]
+    )
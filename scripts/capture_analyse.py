@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+#
+# Analyse an input waveform capture and suggest a debounce setting.
+#
+# Arm a capture with the 'captureInput' command, wait for the 'capture
+# complete' status message, then download and analyse it, e.g.
+#   scripts/capture_analyse.py http://<device>/capture
+#   scripts/capture_analyse.py capture.csv
+#   curl -s http://<device>/capture | scripts/capture_analyse.py
+#
+# Transitions closer together than the gap (default 10ms) are treated as a
+# single bouncing edge. The suggested debounce covers the longest bounce
+# seen, with some margin.
+
+import argparse
+import math
+import sys
+import urllib.request
+
+# must match the debounceMs limits in the firmware config schema
+DEBOUNCE_MIN_MS = 1
+DEBOUNCE_MAX_MS = 255
+
+def read_capture(source):
+    if source == "-":
+        return sys.stdin.read()
+
+    if source.startswith("http://") or source.startswith("https://"):
+        with urllib.request.urlopen(source) as response:
+            return response.read().decode()
+
+    with open(source) as file:
+        return file.read()
+
+def parse_capture(text):
+    index = None
+    pin = None
+    samples = []
+
+    for line in text.splitlines():
+        line = line.strip()
+        if not line or line == "us,word":
+            continue
+
+        # '# index <index> pin <pin>'
+        if line.startswith("#"):
+            parts = line[1:].split()
+            index = int(parts[parts.index("index") + 1])
+            pin = int(parts[parts.index("pin") + 1])
+            continue
+
+        us, word = line.split(",")
+        samples.append((int(us), int(word, 16)))
+
+    if pin is None or len(samples) < 2:
+        raise ValueError("not a capture (missing header or samples)")
+
+    return index, pin, samples
+
+def find_bounces(levels, gap_us):
+    # transitions as (us, new level)
+    transitions = []
+    for (_, previous), (us, level) in zip(levels, levels[1:]):
+        if level != previous:
+            transitions.append((us, level))
+
+    # group transitions closer together than the gap into a single edge
+    bounces = []
+    for us, level in transitions:
+        if bounces and us - bounces[-1]["end"] < gap_us:
+            bounces[-1]["end"] = us
+            bounces[-1]["count"] += 1
+            bounces[-1]["level"] = level
+        else:
+            bounces.append({ "start": us, "end": us, "count": 1, "level": level })
+
+    return transitions, bounces
+
+def main():
+    parser = argparse.ArgumentParser(description="Analyse an input waveform capture")
+    parser.add_argument("source", nargs="?", default="-", help="capture URL, file, or - for stdin")
+    parser.add_argument("--gap", type=float, default=10.0, help="max ms between transitions of one bouncing edge")
+    parser.add_argument("--margin", type=float, default=1.5, help="safety factor applied to the longest bounce")
+    args = parser.parse_args()
+
+    index, pin, samples = parse_capture(read_capture(args.source))
+
+    # active low, as seen by the firmware before any invert
+    levels = [(us, 0 if word & (1 << pin) else 1) for us, word in samples]
+    # the first sample is from the scan before the edge, not the fast burst
+    intervals = [b[0] - a[0] for a, b in zip(samples[1:], samples[2:])]
+
+    print("Input %d (pin %d): %d samples over %.1fms" % (index, pin, len(samples), samples[-1][0] / 1000.0))
+    if intervals:
+        print("Sample interval: %.0fus average, %dus max" % (sum(intervals) / len(intervals), max(intervals)))
+
+    transitions, bounces = find_bounces(levels, args.gap * 1000)
+    print("Transitions: %d" % len(transitions))
+
+    for bounce in bounces:
+        print("  %8.3fms  %s after %d transition(s) over %.3fms" % (
+            bounce["start"] / 1000.0,
+            "active" if bounce["level"] else "idle",
+            bounce["count"],
+            (bounce["end"] - bounce["start"]) / 1000.0))
+
+    longest_ms = max((bounce["end"] - bounce["start"]) / 1000.0 for bounce in bounces) if bounces else 0
+    debounce_ms = min(max(math.ceil(longest_ms * args.margin), DEBOUNCE_MIN_MS), DEBOUNCE_MAX_MS)
+
+    if longest_ms == 0:
+        print("No bounce seen, the input is clean: suggested debounceMs %d" % debounce_ms)
+    else:
+        print("Longest bounce %.3fms: suggested debounceMs %d" % (longest_ms, debounce_ms))
+
+    if longest_ms * args.margin > DEBOUNCE_MAX_MS:
+        print("Warning: bounce is longer than the maximum debounce, check the wiring")
+
+if __name__ == "__main__":
+    main()
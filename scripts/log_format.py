@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+#
+# Turn the structured log events published by the firmware back into text.
+#
+# Reads from stdin, either the JSON payloads from the <status>/log topic, e.g.
+#   mosquitto_sub -t 'stat/<device>/log' | scripts/log_format.py
+# or the serial output of a NO_MQTT_LOGGER build, e.g.
+#   pio device monitor | scripts/log_format.py
+#
+# The text for each event ID is read from the LOG_* defines in src/main.cpp.
+# Anything that isn't a log event is passed through untouched.
+
+import json
+import os
+import re
+import sys
+
+SOURCE = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "src", "main.cpp")
+
+LOG_DEFINE = re.compile(r"^#define\s+LOG_\w+\s+(\d+)\s+//\s*(.+)$")
+LOG_ID_COUNT = re.compile(r"^#define\s+LOG_ID_COUNT\s+(\d+)")
+
+def load_formats(path):
+    formats = {}
+    count = 0
+
+    with open(path) as file:
+        for line in file:
+            match = LOG_ID_COUNT.match(line.strip())
+            if match:
+                count = int(match.group(1))
+
+            match = LOG_DEFINE.match(line.strip())
+            if match:
+                formats[int(match.group(1))] = match.group(2).strip()
+
+    # the other LOG_* defines are buffer settings, not event IDs
+    return { id: text for id, text in formats.items() if id < count }
+
+def group_address(address):
+    return "%d/%d/%d" % (address >> 11, (address >> 8) & 0x07, address & 0xFF)
+
+def format_event(formats, ms, id, arg):
+    text = formats.get(id, "unknown log event %d (%%u)" % id)
+    text = text.replace("%ga", group_address(arg)).replace("%u", str(arg))
+
+    return "[%10.3f] [knx] %s" % (ms / 1000.0, text)
+
+def format_suppressed(formats, id, count):
+    text = formats.get(id, "unknown log event %d" % id)
+    text = text.replace("%ga", "?").replace("%u", "?")
+
+    return "[knx] %d more '%s' suppressed" % (count, text)
+
+def format_line(formats, line):
+    line = line.rstrip("\n")
+
+    # JSON payload from the log topic
+    if line.startswith("{"):
+        try:
+            payload = json.loads(line)
+        except ValueError:
+            return [line]
+
+        if "log" not in payload:
+            return [line]
+
+        lines = [format_event(formats, *entry) for entry in payload["log"]]
+        lines += [format_suppressed(formats, *entry) for entry in payload.get("suppressed", [])]
+        return lines
+
+    # Compact serial output
+    parts = line.split()
+    if len(parts) == 4 and parts[0] == "[log]" and parts[1] == "suppressed":
+        return [format_suppressed(formats, int(parts[2]), int(parts[3]))]
+
+    if len(parts) == 4 and parts[0] == "[log]":
+        return [format_event(formats, int(parts[1]), int(parts[2]), int(parts[3]))]
+
+    return [line]
+
+def main():
+    formats = load_formats(SOURCE)
+
+    for line in sys.stdin:
+        for text in format_line(formats, line):
+            print(text)
+        sys.stdout.flush()
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,132 @@
+/**
+  Bounded input event queue for the OXRS KNX state monitor firmware
+
+  Copyright 2023 Ben Jones <ben.jones12@gmail.com>
+*/
+
+#include "EventQueue.h"
+
+EventQueue::EventQueue(uint16_t coalesceTypes, uint16_t protectedTypes)
+{
+  _coalesceTypes = coalesceTypes;
+  _protectedTypes = protectedTypes;
+
+  _count = 0;
+  _highWater = 0;
+
+  _coalesced = 0;
+  _deferred = 0;
+  _dropped = 0;
+  _protectedDropped = 0;
+}
+
+void EventQueue::push(uint8_t index, uint8_t type, uint8_t state)
+{
+  // Bi-stable inputs only need their latest state, so update any queued event
+  if (_isType(_coalesceTypes, type))
+  {
+    for (uint8_t i = 0; i < _count; i++)
+    {
+      if (_events[i].index == index)
+      {
+        _events[i].type = type;
+        _events[i].state = state;
+        _coalesced++;
+        return;
+      }
+    }
+  }
+
+  if (_count == EVENT_QUEUE_SIZE)
+  {
+    // Make room for protected events by dropping the oldest unprotected
+    // event instead
+    uint8_t dropIdx = EVENT_QUEUE_SIZE;
+    bool isProtected = _isType(_protectedTypes, type);
+    if (isProtected)
+    {
+      for (uint8_t i = 0; i < _count; i++)
+      {
+        if (!_isType(_protectedTypes, _events[i].type))
+        {
+          dropIdx = i;
+          break;
+        }
+      }
+    }
+
+    // Nothing to make room with, this event has to go
+    if (dropIdx == EVENT_QUEUE_SIZE)
+    {
+      if (isProtected)
+      {
+        _protectedDropped++;
+      }
+      else
+      {
+        _dropped++;
+      }
+      return;
+    }
+
+    _dropped++;
+
+    _remove(dropIdx, 1);
+  }
+
+  _events[_count].index = index;
+  _events[_count].type = type;
+  _events[_count].state = state;
+  _events[_count].deferred = false;
+  _count++;
+
+  if (_count > _highWater)
+  {
+    _highWater = _count;
+  }
+}
+
+uint8_t EventQueue::drain(uint8_t count, eventPublisher publisher)
+{
+  uint8_t published = 0;
+  uint8_t held = 0;
+
+  for (uint8_t i = 0; i < _count; i++)
+  {
+    InputEvent event = _events[i];
+
+    if (published < count && !_isHeld(event.index, held) && publisher(event.index, event.type, event.state))
+    {
+      published++;
+      continue;
+    }
+
+    // Anything left has to wait for the next loop, keep it in order
+    if (!event.deferred)
+    {
+      event.deferred = true;
+      _deferred++;
+    }
+    _events[held++] = event;
+  }
+
+  _count = held;
+  return published;
+}
+
+bool EventQueue::_isHeld(uint8_t index, uint8_t heldCount)
+{
+  for (uint8_t i = 0; i < heldCount; i++)
+  {
+    if (_events[i].index == index)
+      return true;
+  }
+
+  return false;
+}
+
+void EventQueue::_remove(uint8_t idx, uint8_t count)
+{
+  memmove(&_events[idx], &_events[idx + count], (_count - idx - count) * sizeof(InputEvent));
+  _count -= count;
+}
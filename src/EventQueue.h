@@ -0,0 +1,82 @@
+/**
+  Bounded input event queue for the OXRS KNX state monitor firmware
+
+  Events are queued as inputs change and published a few at a time from
+  the main loop, so an event storm (e.g. a whole floor powering up) can't
+  stall input scanning or KNX processing. When the queue is under pressure:
+    - events for bi-stable inputs are coalesced to the latest state
+    - protected (security) events take the place of the oldest
+      unprotected event, they are only dropped if the queue is entirely
+      protected events (counted separately)
+    - anything else is dropped, and counted
+
+  Only depends on the C library so it can be tested on the host, see
+  test/test_event_queue.
+
+  Copyright 2023 Ben Jones <ben.jones12@gmail.com>
+*/
+
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include <stdint.h>
+#include <string.h>
+
+// One event per input (8x MCP23017s with 16 pins each), so a full query of
+// bi-stable inputs can never overflow it
+#define       EVENT_QUEUE_SIZE      128
+
+// Used to queue input events for publishing
+struct InputEvent
+{
+  uint8_t index;
+  uint8_t type;
+  uint8_t state;
+  bool deferred;
+};
+
+// Returns false if the event can't be published yet (it stays queued)
+typedef bool (*eventPublisher)(uint8_t index, uint8_t type, uint8_t state);
+
+class EventQueue
+{
+  public:
+    // Types are passed as bitmasks of input type values
+    EventQueue(uint16_t coalesceTypes, uint16_t protectedTypes);
+
+    // Queue an event, coalescing or dropping if needed
+    void push(uint8_t index, uint8_t type, uint8_t state);
+    // Publish up to count events in order, returns how many. Events the
+    // publisher holds back stay queued, along with any later events for the
+    // same input so they are never published out of order
+    uint8_t drain(uint8_t count, eventPublisher publisher);
+
+    // Diagnostics
+    uint8_t getCount() { return _count; }
+    uint8_t getHighWater() { return _highWater; }
+    void resetHighWater() { _highWater = _count; }
+    uint32_t getCoalesced() { return _coalesced; }
+    // Events that had to wait for a later drain (each counted once)
+    uint32_t getDeferred() { return _deferred; }
+    uint32_t getDropped() { return _dropped; }
+    uint32_t getProtectedDropped() { return _protectedDropped; }
+
+  private:
+    uint16_t _coalesceTypes;
+    uint16_t _protectedTypes;
+
+    InputEvent _events[EVENT_QUEUE_SIZE];
+    uint8_t _count;
+    uint8_t _highWater;
+
+    uint32_t _coalesced;
+    uint32_t _deferred;
+    uint32_t _dropped;
+    uint32_t _protectedDropped;
+
+    bool _isType(uint16_t types, uint8_t type) { return type < 16 && (types & (1 << type)); }
+    bool _isHeld(uint8_t index, uint8_t heldCount);
+    void _remove(uint8_t idx, uint8_t count);
+};
+
+#endif
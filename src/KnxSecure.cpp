@@ -0,0 +1,319 @@
+/**
+  KNX Data Secure support for the OXRS KNX state monitor firmware
+
+  Copyright 2023 Ben Jones <ben.jones12@gmail.com>
+*/
+
+#include "KnxSecure.h"
+
+KnxSecure::KnxSecure()
+{
+  memset(_keyRefs, 0, sizeof(_keyRefs));
+
+  _txSequence = 0;
+  _txSequenceReserved = 0;
+
+  memset(_peers, 0, sizeof(_peers));
+
+  _macFailures = 0;
+  _replayFailures = 0;
+  _peerOverflows = 0;
+}
+
+void KnxSecure::begin()
+{
+  _nvs.begin("knxsecure");
+
+  // Anything below the reserved value may already have been sent, so
+  // always restart from there (sequence numbers must never be reused)
+  _txSequence = _nvs.getULong64("txseq", 1);
+  _txSequenceReserved = _txSequence;
+
+  // Restore the last sequence number seen from each sender
+  for (uint8_t i = 0; i < KNX_SECURE_PEER_COUNT; i++)
+  {
+    char key[8];
+    sprintf(key, "peer%u", i);
+    _nvs.getBytes(key, &_peers[i], sizeof(Peer));
+  }
+}
+
+uint8_t KnxSecure::addKey(const uint8_t key[KNX_SECURE_KEY_LENGTH])
+{
+  // Re-use the slot if this key has already been scheduled
+  uint8_t free = KNX_SECURE_KEY_COUNT;
+  for (uint8_t slot = 0; slot < KNX_SECURE_KEY_COUNT; slot++)
+  {
+    if (_keyRefs[slot] == 0)
+    {
+      if (free == KNX_SECURE_KEY_COUNT) { free = slot; }
+      continue;
+    }
+
+    if (memcmp(_keys[slot], key, KNX_SECURE_KEY_LENGTH) == 0)
+    {
+      _keyRefs[slot]++;
+      return slot + 1;
+    }
+  }
+
+  if (free == KNX_SECURE_KEY_COUNT)
+    return 0;
+
+  // Run the key schedule once, up front
+  mbedtls_aes_init(&_aes[free]);
+  mbedtls_aes_setkey_enc(&_aes[free], key, KNX_SECURE_KEY_LENGTH * 8);
+  memcpy(_keys[free], key, KNX_SECURE_KEY_LENGTH);
+  _keyRefs[free] = 1;
+
+  // Return the 1-based slot
+  return free + 1;
+}
+
+void KnxSecure::removeKey(uint8_t keySlot)
+{
+  if (keySlot == 0 || keySlot > KNX_SECURE_KEY_COUNT || _keyRefs[keySlot - 1] == 0)
+    return;
+
+  if (--_keyRefs[keySlot - 1] > 0)
+    return;
+
+  // Nothing uses this key anymore, free the slot
+  mbedtls_aes_free(&_aes[keySlot - 1]);
+  memset(_keys[keySlot - 1], 0, KNX_SECURE_KEY_LENGTH);
+}
+
+uint8_t KnxSecure::encrypt(uint8_t keySlot, uint16_t source, uint16_t target, const uint8_t * apdu, uint8_t apduLength, uint8_t * secureApdu)
+{
+  if (keySlot == 0 || keySlot > KNX_SECURE_KEY_COUNT || _keyRefs[keySlot - 1] == 0)
+    return 0;
+
+  if (apduLength > KNX_SECURE_APDU_MAX)
+    return 0;
+
+  mbedtls_aes_context * aes = &_aes[keySlot - 1];
+
+  // 48-bit sequence number, big-endian
+  uint64_t sequence = _nextSequence();
+  uint8_t seq[KNX_SECURE_SEQ_LENGTH];
+  for (uint8_t i = 0; i < KNX_SECURE_SEQ_LENGTH; i++)
+  {
+    seq[i] = (sequence >> (8 * (KNX_SECURE_SEQ_LENGTH - 1 - i))) & 0xFF;
+  }
+
+  // Authenticate the plain APDU, with the SCF as associated data
+  uint8_t scf = KNX_SECURE_SCF_AUTH_CONF;
+  uint8_t block[16];
+  uint8_t mac[16];
+  _block0(block, seq, source, target, apduLength);
+  _cbcMac(aes, block, &scf, sizeof(scf), apdu, apduLength, mac);
+
+  // Secure APDU header
+  secureApdu[0] = KNX_SECURE_APCI >> 8;
+  secureApdu[1] = KNX_SECURE_APCI & 0xFF;
+  secureApdu[2] = KNX_SECURE_SCF_AUTH_CONF;
+  memcpy(&secureApdu[3], seq, KNX_SECURE_SEQ_LENGTH);
+
+  // Encrypt the APDU and MAC
+  uint8_t * payload = &secureApdu[3 + KNX_SECURE_SEQ_LENGTH];
+  _counter0(block, seq, source, target);
+  _ctr(aes, block, apdu, apduLength, payload, mac);
+  memcpy(&payload[apduLength], mac, KNX_SECURE_MAC_LENGTH);
+
+  return KNX_SECURE_OVERHEAD + apduLength;
+}
+
+uint8_t KnxSecure::decrypt(uint8_t keySlot, uint16_t source, uint16_t target, const uint8_t * secureApdu, uint8_t secureLength, uint8_t * apdu)
+{
+  if (keySlot == 0 || keySlot > KNX_SECURE_KEY_COUNT || _keyRefs[keySlot - 1] == 0)
+    return 0;
+
+  if (secureLength < KNX_SECURE_OVERHEAD || (secureLength - KNX_SECURE_OVERHEAD) > KNX_SECURE_APDU_MAX)
+    return 0;
+
+  // Only S-A_Data with authentication + confidentiality is supported
+  if ((secureApdu[0] & 0x03) != (KNX_SECURE_APCI >> 8) || secureApdu[1] != (KNX_SECURE_APCI & 0xFF))
+    return 0;
+
+  if (secureApdu[2] != KNX_SECURE_SCF_AUTH_CONF)
+    return 0;
+
+  mbedtls_aes_context * aes = &_aes[keySlot - 1];
+
+  const uint8_t * seq = &secureApdu[3];
+  uint64_t sequence = 0;
+  for (uint8_t i = 0; i < KNX_SECURE_SEQ_LENGTH; i++)
+  {
+    sequence = (sequence << 8) | seq[i];
+  }
+
+  uint8_t apduLength = secureLength - KNX_SECURE_OVERHEAD;
+  const uint8_t * payload = &secureApdu[3 + KNX_SECURE_SEQ_LENGTH];
+
+  // Decrypt the APDU and MAC
+  uint8_t block[16];
+  uint8_t mac[16];
+  memcpy(mac, &payload[apduLength], KNX_SECURE_MAC_LENGTH);
+  _counter0(block, seq, source, target);
+  _ctr(aes, block, payload, apduLength, apdu, mac);
+
+  // Verify the MAC over the decrypted APDU
+  uint8_t scf = KNX_SECURE_SCF_AUTH_CONF;
+  uint8_t expected[16];
+  _block0(block, seq, source, target, apduLength);
+  _cbcMac(aes, block, &scf, sizeof(scf), apdu, apduLength, expected);
+
+  if (memcmp(mac, expected, KNX_SECURE_MAC_LENGTH) != 0)
+  {
+    _macFailures++;
+    return 0;
+  }
+
+  // Only accept increasing sequence numbers from each sender (counts
+  // replay/overflow failures itself)
+  if (!_checkSequence(source, sequence))
+    return 0;
+
+  return apduLength;
+}
+
+uint64_t KnxSecure::_nextSequence()
+{
+  // Reserve another block of sequence numbers in NVS before using them
+  if (_txSequence >= _txSequenceReserved)
+  {
+    _txSequenceReserved = _txSequence + KNX_SECURE_SEQ_RESERVE;
+    _nvs.putULong64("txseq", _txSequenceReserved);
+  }
+
+  return _txSequence++;
+}
+
+bool KnxSecure::_checkSequence(uint16_t source, uint64_t sequence)
+{
+  Peer * free = NULL;
+
+  for (uint8_t i = 0; i < KNX_SECURE_PEER_COUNT; i++)
+  {
+    if (_peers[i].source == source)
+    {
+      if (sequence <= _peers[i].sequence)
+      {
+        _replayFailures++;
+        return false;
+      }
+
+      _peers[i].sequence = sequence;
+      _persistPeer(i);
+      return true;
+    }
+
+    if (free == NULL && _peers[i].source == 0)
+    {
+      free = &_peers[i];
+    }
+  }
+
+  // First telegram from this sender, if the table is full then reject it,
+  // evicting another sender would let old telegrams from it be replayed
+  if (free == NULL)
+  {
+    _peerOverflows++;
+    return false;
+  }
+
+  free->source = source;
+  free->sequence = sequence;
+  _persistPeer(free - _peers);
+  return true;
+}
+
+void KnxSecure::_persistPeer(uint8_t peer)
+{
+  // Persisted before the telegram is acted on, so a reboot can never let
+  // a telegram we have already accepted be replayed. Only the one peer is
+  // written, and secure telegrams are rare enough for NVS wear levelling
+  char key[8];
+  sprintf(key, "peer%u", peer);
+  _nvs.putBytes(key, &_peers[peer], sizeof(Peer));
+}
+
+void KnxSecure::_block0(uint8_t block[16], const uint8_t * sequence, uint16_t source, uint16_t target, uint8_t payloadLength)
+{
+  // B0 = SeqNr | source | target | 0x00 | frame flags | TPCI/APCI | 0x00 | payload length
+  memcpy(block, sequence, KNX_SECURE_SEQ_LENGTH);
+  block[6]  = source >> 8;
+  block[7]  = source & 0xFF;
+  block[8]  = target >> 8;
+  block[9]  = target & 0xFF;
+  block[10] = 0x00;
+  block[11] = 0x80;                   // group address, standard frame
+  block[12] = KNX_SECURE_APCI >> 8;
+  block[13] = KNX_SECURE_APCI & 0xFF;
+  block[14] = 0x00;
+  block[15] = payloadLength;
+}
+
+void KnxSecure::_counter0(uint8_t block[16], const uint8_t * sequence, uint16_t source, uint16_t target)
+{
+  // Ctr0 = SeqNr | source | target | 0x00000000 | 0x01 | counter
+  memcpy(block, sequence, KNX_SECURE_SEQ_LENGTH);
+  block[6]  = source >> 8;
+  block[7]  = source & 0xFF;
+  block[8]  = target >> 8;
+  block[9]  = target & 0xFF;
+  block[10] = 0x00;
+  block[11] = 0x00;
+  block[12] = 0x00;
+  block[13] = 0x00;
+  block[14] = 0x01;
+  block[15] = 0x00;
+}
+
+void KnxSecure::_cbcMac(mbedtls_aes_context * aes, const uint8_t block0[16], const uint8_t * data, uint8_t dataLength, const uint8_t * payload, uint8_t payloadLength, uint8_t mac[16])
+{
+  uint8_t block[16];
+
+  // B0
+  mbedtls_aes_crypt_ecb(aes, MBEDTLS_AES_ENCRYPT, block0, mac);
+
+  // Associated data (16-bit length prefix, as CCM), zero padded
+  uint16_t streamLength = 2 + dataLength;
+  for (uint16_t offset = 0; offset < streamLength; offset += 16)
+  {
+    memcpy(block, mac, sizeof(block));
+    for (uint8_t i = 0; i < 16 && (offset + i) < streamLength; i++)
+    {
+      uint16_t position = offset + i;
+      block[i] ^= position == 0 ? 0 : position == 1 ? dataLength : data[position - 2];
+    }
+    mbedtls_aes_crypt_ecb(aes, MBEDTLS_AES_ENCRYPT, block, mac);
+  }
+
+  // Payload, zero padded
+  for (uint8_t offset = 0; offset < payloadLength; offset += 16)
+  {
+    memcpy(block, mac, sizeof(block));
+    for (uint8_t i = 0; i < 16 && (offset + i) < payloadLength; i++) { block[i] ^= payload[offset + i]; }
+    mbedtls_aes_crypt_ecb(aes, MBEDTLS_AES_ENCRYPT, block, mac);
+  }
+}
+
+void KnxSecure::_ctr(mbedtls_aes_context * aes, const uint8_t counter0[16], const uint8_t * in, uint8_t length, uint8_t * out, uint8_t * mac)
+{
+  uint8_t counter[16];
+  uint8_t stream[16];
+
+  // Counter 0 is used to mask the MAC
+  memcpy(counter, counter0, sizeof(counter));
+  mbedtls_aes_crypt_ecb(aes, MBEDTLS_AES_ENCRYPT, counter, stream);
+  for (uint8_t i = 0; i < KNX_SECURE_MAC_LENGTH; i++) { mac[i] ^= stream[i]; }
+
+  // Subsequent counters are used for the payload
+  for (uint8_t offset = 0; offset < length; offset += 16)
+  {
+    counter[15]++;
+    mbedtls_aes_crypt_ecb(aes, MBEDTLS_AES_ENCRYPT, counter, stream);
+    for (uint8_t i = 0; i < 16 && (offset + i) < length; i++) { out[offset + i] = in[offset + i] ^ stream[i]; }
+  }
+}
@@ -0,0 +1,105 @@
+/**
+  KNX Data Secure support for the OXRS KNX state monitor firmware
+
+  Implements the S-A_Data service (AES-128 CCM, authentication and
+  confidentiality) for group communication, as described in KNX AN158
+  and the KNX Data Secure specification (03_03_07).
+
+  AES block operations go through mbedtls, which uses the ESP32 hardware
+  AES peripheral when available. Each key is scheduled once when it is
+  added and all working buffers are on the stack, so nothing is allocated
+  per telegram.
+
+  Copyright 2023 Ben Jones <ben.jones12@gmail.com>
+*/
+
+#ifndef KNX_SECURE_H
+#define KNX_SECURE_H
+
+#include <Arduino.h>
+#include <Preferences.h>              // For persisting sequence counters
+#include <mbedtls/aes.h>              // For AES block cipher
+
+// Max number of distinct group keys we can schedule
+#define       KNX_SECURE_KEY_COUNT          16
+// Max number of senders we track sequence counters for (replay protection),
+// secure telegrams from any more senders are rejected
+#define       KNX_SECURE_PEER_COUNT         32
+
+#define       KNX_SECURE_KEY_LENGTH         16
+#define       KNX_SECURE_SEQ_LENGTH         6
+#define       KNX_SECURE_MAC_LENGTH         4
+
+// A_SecureService APCI (TPCI bits are 0 for group communication)
+#define       KNX_SECURE_APCI               0x03F1
+// Security control field: S-A_Data, CCM with authentication + confidentiality
+#define       KNX_SECURE_SCF_AUTH_CONF      0x10
+
+// Secure APDU overhead = APCI (2) + SCF (1) + sequence number + MAC
+#define       KNX_SECURE_OVERHEAD           (3 + KNX_SECURE_SEQ_LENGTH + KNX_SECURE_MAC_LENGTH)
+// Largest plain APDU we will wrap (must still fit a standard frame)
+#define       KNX_SECURE_APDU_MAX           (16 - KNX_SECURE_OVERHEAD)
+
+// Number of sequence numbers reserved in NVS at a time (limits flash writes)
+#define       KNX_SECURE_SEQ_RESERVE        1000
+
+class KnxSecure
+{
+  public:
+    KnxSecure();
+
+    // Load persisted sequence counters from NVS
+    void begin();
+
+    // Schedule a key, returns the 1-based key slot (0 if no slots left)
+    uint8_t addKey(const uint8_t key[KNX_SECURE_KEY_LENGTH]);
+    // Release a key slot returned by addKey(), freed once nothing uses it
+    void removeKey(uint8_t keySlot);
+
+    // Wrap a plain APDU into a secure APDU, returns length (0 on failure)
+    uint8_t encrypt(uint8_t keySlot, uint16_t source, uint16_t target, const uint8_t * apdu, uint8_t apduLength, uint8_t * secureApdu);
+    // Unwrap a secure APDU, returns plain APDU length (0 on MAC/replay failure)
+    uint8_t decrypt(uint8_t keySlot, uint16_t source, uint16_t target, const uint8_t * secureApdu, uint8_t secureLength, uint8_t * apdu);
+
+    // Diagnostics
+    uint32_t getMacFailures() { return _macFailures; }
+    uint32_t getReplayFailures() { return _replayFailures; }
+    uint32_t getPeerOverflows() { return _peerOverflows; }
+
+  private:
+#if defined(UNIT_TEST)
+    friend class KnxSecureTest;
+#endif
+
+    struct Peer
+    {
+      uint16_t source;
+      uint64_t sequence;
+    };
+
+    Preferences _nvs;
+
+    mbedtls_aes_context _aes[KNX_SECURE_KEY_COUNT];
+    uint8_t _keys[KNX_SECURE_KEY_COUNT][KNX_SECURE_KEY_LENGTH];
+    uint8_t _keyRefs[KNX_SECURE_KEY_COUNT];
+
+    uint64_t _txSequence;
+    uint64_t _txSequenceReserved;
+
+    Peer _peers[KNX_SECURE_PEER_COUNT];
+
+    uint32_t _macFailures;
+    uint32_t _replayFailures;
+    uint32_t _peerOverflows;
+
+    uint64_t _nextSequence();
+    bool _checkSequence(uint16_t source, uint64_t sequence);
+    void _persistPeer(uint8_t peer);
+
+    void _block0(uint8_t block[16], const uint8_t * sequence, uint16_t source, uint16_t target, uint8_t payloadLength);
+    void _counter0(uint8_t block[16], const uint8_t * sequence, uint16_t source, uint16_t target);
+    void _cbcMac(mbedtls_aes_context * aes, const uint8_t block0[16], const uint8_t * data, uint8_t dataLength, const uint8_t * payload, uint8_t payloadLength, uint8_t mac[16]);
+    void _ctr(mbedtls_aes_context * aes, const uint8_t counter0[16], const uint8_t * in, uint8_t length, uint8_t * out, uint8_t * mac);
+};
+
+#endif
@@ -0,0 +1,115 @@
+/**
+  MQTT publish accounting and synthetic load for the OXRS KNX state
+  monitor firmware
+
+  Copyright 2023 Ben Jones <ben.jones12@gmail.com>
+*/
+
+#include "MqttStats.h"
+
+MqttStats::MqttStats()
+{
+  _published = 0;
+  _failed = 0;
+
+  resetPeriod();
+}
+
+void MqttStats::record(bool success, uint32_t latencyUs)
+{
+  if (success)
+  {
+    _published++;
+  }
+  else
+  {
+    _failed++;
+  }
+
+  uint8_t bucket = 0;
+  while (bucket < MQTT_LATENCY_BUCKETS - 1 && latencyUs >= MQTT_LATENCY_BUCKET_US[bucket])
+  {
+    bucket++;
+  }
+
+  _latency[bucket]++;
+
+  if (latencyUs > _maxLatencyUs)
+  {
+    _maxLatencyUs = latencyUs;
+  }
+}
+
+void MqttStats::resetPeriod()
+{
+  memset(_latency, 0, sizeof(_latency));
+  _maxLatencyUs = 0;
+}
+
+MqttBenchmark::MqttBenchmark(uint16_t maxRate, uint32_t maxDurationMs, uint8_t perLoop)
+{
+  _maxRate = maxRate;
+  _maxDurationMs = maxDurationMs;
+  _perLoop = perLoop;
+
+  _rate = 0;
+  _lastRate = 0;
+  _durationMs = 0;
+  _startMs = 0;
+  _elapsedMs = 0;
+  _sent = 0;
+  _failed = 0;
+}
+
+void MqttBenchmark::start(uint16_t rate, uint32_t durationMs, uint32_t nowMs)
+{
+  if (rate == 0 || durationMs == 0)
+    return;
+
+  _rate = rate < _maxRate ? rate : _maxRate;
+  _lastRate = _rate;
+  _durationMs = durationMs < _maxDurationMs ? durationMs : _maxDurationMs;
+  _startMs = nowMs;
+  _elapsedMs = 0;
+  _sent = 0;
+  _failed = 0;
+}
+
+bool MqttBenchmark::loop(uint32_t nowMs, benchmarkPublisher publisher)
+{
+  if (_rate == 0)
+    return false;
+
+  _elapsedMs = nowMs - _startMs;
+
+  if (_elapsedMs >= _durationMs)
+  {
+    _rate = 0;
+    return true;
+  }
+
+  // Catch up with the target rate, but only so much per loop
+  uint32_t due = ((uint64_t)_elapsedMs * _rate / 1000) - _sent;
+  if (due > _perLoop)
+  {
+    due = _perLoop;
+  }
+
+  for (uint32_t i = 0; i < due; i++)
+  {
+    if (!publisher(_sent++))
+    {
+      _failed++;
+    }
+  }
+
+  return false;
+}
+
+float MqttBenchmark::getSustainedRate()
+{
+  if (_elapsedMs == 0)
+    return 0;
+
+  return (float)(_sent - _failed) * 1000 / _elapsedMs;
+}
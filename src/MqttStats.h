@@ -0,0 +1,85 @@
+/**
+  MQTT publish accounting and synthetic load for the OXRS KNX state
+  monitor firmware
+
+  MqttStats keeps publish counts and a latency histogram (per telemetry
+  period). MqttBenchmark paces synthetic publishes at a fixed rate, at
+  most a few per loop so the load shows up as backlog rather than a
+  stalled loop (only used by MQTT_BENCHMARK builds).
+
+  Only depends on the C library so it can be tested on the host, and the
+  same pacing and accounting drives the host broker benchmark, see
+  test/test_mqtt_stats and test/test_mqtt_benchmark.
+
+  Copyright 2023 Ben Jones <ben.jones12@gmail.com>
+*/
+
+#ifndef MQTT_STATS_H
+#define MQTT_STATS_H
+
+#include <stdint.h>
+#include <string.h>
+
+// MQTT publish latency histogram (upper bound of each bucket, last is open)
+const uint32_t MQTT_LATENCY_BUCKET_US[] = { 1000, 5000, 20000, 100000 };
+const uint8_t  MQTT_LATENCY_BUCKETS     = sizeof(MQTT_LATENCY_BUCKET_US) / sizeof(uint32_t) + 1;
+
+class MqttStats
+{
+  public:
+    MqttStats();
+
+    // Account for a single publish
+    void record(bool success, uint32_t latencyUs);
+    // Start a fresh latency histogram and peak (counts are kept)
+    void resetPeriod();
+
+    uint32_t getPublished() { return _published; }
+    uint32_t getFailed() { return _failed; }
+    uint32_t getMaxLatencyUs() { return _maxLatencyUs; }
+    uint32_t getLatency(uint8_t bucket) { return _latency[bucket]; }
+
+  private:
+    uint32_t _published;
+    uint32_t _failed;
+    uint32_t _latency[MQTT_LATENCY_BUCKETS];
+    uint32_t _maxLatencyUs;
+};
+
+// Publishes a single synthetic event, returns false if the publish failed
+typedef bool (*benchmarkPublisher)(uint32_t sequence);
+
+class MqttBenchmark
+{
+  public:
+    MqttBenchmark(uint16_t maxRate, uint32_t maxDurationMs, uint8_t perLoop);
+
+    // Start a run (rate and duration are clamped to the limits)
+    void start(uint16_t rate, uint32_t durationMs, uint32_t nowMs);
+    bool isRunning() { return _rate != 0; }
+
+    // Publish whatever is due, returns true when the run has just finished
+    bool loop(uint32_t nowMs, benchmarkPublisher publisher);
+
+    // Results of the current (or last) run
+    uint16_t getRate() { return _lastRate; }
+    uint32_t getElapsedMs() { return _elapsedMs; }
+    uint32_t getSent() { return _sent; }
+    uint32_t getFailed() { return _failed; }
+    float getSustainedRate();
+
+  private:
+    uint16_t _maxRate;
+    uint32_t _maxDurationMs;
+    uint8_t _perLoop;
+
+    uint16_t _rate;
+    uint16_t _lastRate;
+    uint32_t _durationMs;
+    uint32_t _startMs;
+    uint32_t _elapsedMs;
+    uint32_t _sent;
+    uint32_t _failed;
+};
+
+#endif
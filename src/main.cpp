@@ -17,8 +17,14 @@
 #include <Arduino.h>
 #include <Adafruit_MCP23X17.h>        // For MCP23017 I/O buffers
 #include <OXRS_Input.h>               // For input handling
-#include <OXRS_HASS.h>                // For Home Assistant self-discovery
 #include <KnxTpUart.h>                // For KNX BCU
+#include "KnxSecure.h"                // For KNX Data Secure
+#include "EventQueue.h"               // For input event backpressure
+#include "MqttStats.h"                // For MQTT publish accounting
+
+#if !defined(NO_HASS)
+#include <OXRS_HASS.h>                // For Home Assistant self-discovery
+#endif
 
 #if defined(OXRS_RACK32)
 #include <OXRS_Rack32.h>              // Rack32 support
@@ -28,6 +34,25 @@ OXRS_Rack32 oxrs;
 OXRS_Black oxrs;
 #endif
 
+// Lean builds (see platformio.ini) can strip features at compile time
+//  NO_HASS         - no Home Assistant self-discovery
+//  NO_LCD          - no port display updates
+//  NO_REST         - no input waveform capture, or its /capture REST endpoint
+//  NO_MQTT_LOGGER  - log to serial only, not the MQTT log topic
+// Debug builds can add diagnostics that have no place in release firmware
+//  MQTT_BENCHMARK  - synthetic MQTT load generator (mqttBenchmark command)
+// The lean envs also unflag OXRS_LCD_ENABLE so the board libraries are built
+// without the LCD, this only keeps the firmware's own display code out
+#if defined(NO_LCD)
+#undef OXRS_LCD_ENABLE
+#endif
+
+#if defined(NO_MQTT_LOGGER)
+Print & logger = Serial;
+#else
+Print & logger = oxrs;
+#endif
+
 /*--------------------------- Constants -------------------------------*/
 // Serial
 #define       SERIAL_BAUD_RATE      115200
@@ -45,9 +70,95 @@ const uint8_t MCP_COUNT             = sizeof(MCP_I2C_ADDRESS);
 // Speed up the I2C bus to get faster event handling
 #define       I2C_CLOCK_SPEED       400000L
 
+// Quadrature transitions per detent for ROTARY encoders
+#define       ROTARY_TRANSITIONS_PER_DETENT 4
+
+// MCPs with ROTARY encoders are sampled by their own task at a fixed rate
+// (1ms is one FreeRTOS tick), above the priority of the Arduino loop task
+#define       ROTARY_SCAN_MS        1
+#define       ROTARY_TASK_PRIORITY  2
+#define       ROTARY_TASK_STACK     2048
+
+// Quadrature decoder state table, indexed by (previous A/B << 2) | current A/B
+#define       ROTARY_INVALID        2           // both A/B changed, a transition was lost
+const int8_t  ROTARY_TABLE[16]      = {  0,  1, -1,  ROTARY_INVALID,
+                                        -1,  0,  ROTARY_INVALID,  1,
+                                         1,  ROTARY_INVALID,  0, -1,
+                                         ROTARY_INVALID, -1,  1,  0 };
+
+// Per-input timing (inputs with custom timing are scanned by the firmware)
+#define       INPUT_DEBOUNCE_MS     20          // defaults for any timing not set
+#define       INPUT_HOLD_MS         800
+#define       INPUT_MULTI_CLICK_MS  300
+#define       INPUT_HOLD_UNIT_MS    100         // stored units, to fit in a byte
+#define       INPUT_CLICK_UNIT_MS   10
+#define       INPUT_MAX_CLICKS      5
+
+// Waveform capture of a single input (served over REST at /capture)
+#define       CAPTURE_SAMPLES       1024        // ~120ms of samples at 400kHz I2C
+#define       CAPTURE_IDLE          0
+#define       CAPTURE_ARMED         1           // waiting for an edge on the input
+#define       CAPTURE_DONE          2
+
+// Structured log ring buffer, flushed from the main loop
+#define       LOG_BUFFER_SIZE       64
+#define       LOG_FLUSH_MS          1000        // 1 second
+#define       LOG_FLUSH_MAX         16          // entries per flush
+#define       LOG_RATE_WINDOW_MS    1000        // 1 second
+#define       LOG_RATE_LIMIT        4           // entries per ID per window
+
+// Log event IDs, formatted on the host by scripts/log_format.py which reads
+// the text from these comments ('%u' is the argument, '%ga' a group address)
+#define       LOG_INVALID_INPUT_TYPE      1     // invalid input type
+#define       LOG_INVALID_DEVICE_ADDRESS  2     // invalid device address
+#define       LOG_INVALID_GROUP_ADDRESS   3     // invalid group address
+#define       LOG_INVALID_SECURE_KEY      4     // invalid secure key
+#define       LOG_SECURE_KEYS_FULL        5     // too many secure keys
+#define       LOG_MISSING_INDEX           6     // missing index
+#define       LOG_INVALID_INDEX           7     // invalid index %u
+#define       LOG_TX_QUEUE_FULL           8     // transmit queue full, command to %ga dropped
+#define       LOG_SECURE_ENCRYPT_FAILED   9     // failed to encrypt secure telegram to %ga
+#define       LOG_VERIFY_FAILED           10    // actuator verification failed for input %u
+#define       LOG_BCU_DOWN                11    // BCU not responding, pausing read scheduler
+#define       LOG_BCU_UP                  12    // BCU recovered after %ums
+#define       LOG_COMMANDS_DROPPED        13    // %u knxCommands not queued
+#define       LOG_ID_COUNT                14
+
+// Max number of queued input events published per loop
+#define       EVENT_DRAIN_PER_LOOP  4
+
+// How often to publish diagnostics
+#define       TELEMETRY_MS          60000       // 1 minute
+
+// MQTT benchmark limits
+#if defined(MQTT_BENCHMARK)
+#define       MQTT_BENCHMARK_MAX_RATE     1000      // events per second
+#define       MQTT_BENCHMARK_MAX_MS       60000     // 1 minute
+#define       MQTT_BENCHMARK_PER_LOOP     10
+#endif
+
+// Minimum time between Home Assistant discovery payloads
+#define       HASS_DISCOVERY_INTERVAL_MS  100
+
+// Home Assistant entities for the KNX actuator controlled by an input
+#define       HASS_ENTITY_NONE      0
+#define       HASS_ENTITY_SWITCH    1
+#define       HASS_ENTITY_LIGHT     2
+
 // Internal constant used when input type parsing fails
 #define       INVALID_INPUT_TYPE    99
 
+// MQTT topic layouts for publishing input events
+#define       EVENT_TOPIC_STATUS    0           // <status>
+#define       EVENT_TOPIC_TYPE      1           // <status>/<type>
+#define       EVENT_TOPIC_EVENT     2           // <status>/<type>/<event>
+
+// KNX transmit queue telegram types
+#define       KNX_TX_WRITE_BOOL     0
+#define       KNX_TX_WRITE_DIM      1
+#define       KNX_TX_READ           2
+#define       KNX_TX_ANSWER_BOOL    3
+
 // KNX BCU on Serial2
 #define       KNX_DEFAULT_ADDRESS   KNX_IA(1, 1, 244)
 #define       KNX_SERIAL_BAUD       19200
@@ -59,12 +170,65 @@ const uint8_t MCP_COUNT             = sizeof(MCP_I2C_ADDRESS);
 #define       KNX_READ_TIMEOUT_MS   5000        // 5 seconds
 #define       KNX_STATE_EXPIRY_MS   3900000     // 65 minutes
 
+// Background reads are only sent once the bus has been quiet for a while
+#define       KNX_BUS_IDLE_MS       500
+#define       KNX_READ_STARVATION_MS  10000     // 10 seconds
+
+// Duplicate telegram suppression (repeats, or copies via multiple couplers)
+#define       KNX_DEDUP_SIZE        8
+#define       KNX_DEDUP_WINDOW_MS   500
+
+// BCU watchdog
+#define       KNX_BCU_FAILURE_LIMIT 3           // failed confirms/reads before probing
+#define       KNX_BCU_PROBE_MS      500         // UART reset timeout when probing
+#define       KNX_BCU_BACKOFF_MIN_MS  1000      // 1 second
+#define       KNX_BCU_BACKOFF_MAX_MS  60000     // 1 minute
+
+// Actuator verification (read, then re-send the command, this many times)
+#define       KNX_VERIFY_MAX_RETRIES  2
+#define       KNX_VERIFY_MAX_MS     10000       // 10 seconds
+
+// Answering reads of slow actuators from our cached state
+#define       KNX_READ_PROXY_MAX_MS 5000        // longest delay before answering
+#define       KNX_READ_PROXY_MAX_AGE_MS 60000   // default freshness limit, 1 minute
+
+// Actuator verification phases
+#define       KNX_VERIFY_IDLE       0
+#define       KNX_VERIFY_WAITING    1           // command sent, waiting on state
+#define       KNX_VERIFY_READING    2           // state read sent, waiting on answer
+
+// Power-on broadcast of bi-stable input states
+#define       KNX_BROADCAST_DELAY_MS    2000    // let inputs settle after the first config
+#define       KNX_BROADCAST_INTERVAL_MS 100     // pacing between broadcast telegrams
+#define       KNX_BROADCAST_NONE    0xFF
+
+// TP-UART framing (we build and stream all our own telegrams)
+#define       KNX_UART_DATA_START   0x80
+#define       KNX_UART_DATA_END     0x40
+#define       KNX_UART_CONFIRM_OK   0x8B        // L_Data.con, positive
+#define       KNX_UART_CONFIRM_FAIL 0x0B        // L_Data.con, negative (no ACK after repeats)
+#define       KNX_FRAME_CONTROL     0xBC        // standard frame, low priority
+#define       KNX_FRAME_CONTROL_MASK  0xD3      // standard frame control field, ignoring
+#define       KNX_FRAME_CONTROL_STD   0x90      // the repeat flag and priority
+#define       KNX_FRAME_HEADER_SIZE 6
+#define       KNX_FRAME_MAX_PAYLOAD 16
+
+// TP-UART transmit pipeline, one frame on the bus and the next in the BCU
+#define       KNX_TX_PIPELINE_DEPTH 2
+#define       KNX_TX_FRAME_QUEUE_SIZE 8
+#define       KNX_TX_CONFIRM_TIMEOUT_MS 1000    // 1 second
+#define       KNX_RX_PER_LOOP       4           // confirmations/telegrams handled per loop
+#define       KNX_UART_BYTE_US      573         // 11 bits (8E1) at 19200 baud
+
 // Max number of supported inputs
 const uint8_t MAX_INPUT_COUNT       = MCP_COUNT * MCP_PIN_COUNT;
 
 // KNX read queue size
 const uint8_t KNX_READ_QUEUE_SIZE   = MAX_INPUT_COUNT;
 
+// KNX transmit queue size (bounds the work a knxCommands payload can queue)
+const uint8_t KNX_TX_QUEUE_SIZE     = 32;
+
 /*-------------------------- Internal datatypes --------------------------*/
 // Used to store KNX config/state
 struct KnxConfig
@@ -77,13 +241,124 @@ struct KnxConfig
   // address for listening for status messages from the KNX actuator
   uint16_t stateAddress;
 
+  // KNX Data Secure key slot for the command/state addresses (0 = plain)
+  uint8_t secureKey;
+
+  // Home Assistant entity to expose for the KNX actuator
+#if !defined(NO_HASS)
+  uint8_t hassEntity;
+#endif
+
   // current state of the KNX actuator
   bool state;
 
   // last time a state update was received
   uint32_t lastStateUpdateMs;
+
+  // time to wait for the actuator to confirm a command (0 = no verification)
+  uint16_t verifyMs;
+
+  // when another device was seen reading our state address (0 = not pending)
+  uint32_t readOverheardMs;
+
+  // time to give the actuator to answer reads before we answer from our
+  // cached state (0 = never answer for it)
+  uint16_t readProxyMs;
+  // when a read we may answer was seen, and when we answered it (0 = not pending)
+  uint32_t readProxyPendingMs;
+  uint32_t readProxyAnsweredMs;
+
+  // verification of the last command sent
+  uint8_t verifyPhase;
+  uint8_t verifyRetries;
+  bool verifyState;
+  uint32_t verifySince;
+};
+
+// Used to buffer structured log events
+struct LogEntry
+{
+  uint32_t ms;
+  uint32_t arg;
+  uint8_t id;
+};
+
+// Used to recognise duplicate telegrams, the last one seen for each source/target
+struct KnxSeenTelegram
+{
+  uint16_t source;
+  uint16_t target;
+  uint32_t hash;
+  uint32_t ms;
+};
+
+// Used to queue complete frames for streaming to the BCU
+struct KnxTxFrame
+{
+  uint8_t size;
+  uint8_t data[KNX_FRAME_HEADER_SIZE + KNX_FRAME_MAX_PAYLOAD + 1];
 };
 
+// Used to queue KNX telegrams for transmission
+struct KnxTxItem
+{
+  uint16_t address;
+  uint8_t type;
+  uint8_t value;
+};
+
+// Per-input timing overrides, stored compactly (0 = default)
+struct InputTiming
+{
+  uint8_t debounce;                   // ms
+  uint8_t hold;                       // INPUT_HOLD_UNIT_MS
+  uint8_t click;                      // INPUT_CLICK_UNIT_MS
+};
+
+// Used to stage input config so it can be applied to the display and input
+// handlers in a single pass, once an entire config payload has been parsed
+struct InputConfig
+{
+  uint8_t type[MCP_PIN_COUNT];
+  uint16_t invert;
+  uint16_t disabled;
+  InputTiming timing[MCP_PIN_COUNT];
+};
+
+// Runtime state for an input with custom timing
+struct TimedInput
+{
+  uint8_t known   : 1;                // level has been sampled
+  uint8_t raw     : 1;                // last raw level (1 = active)
+  uint8_t level   : 1;                // debounced level (1 = active)
+  uint8_t held    : 1;                // hold event sent for this press
+  uint8_t toggle  : 1;                // current TOGGLE state
+  uint8_t clicks;
+  uint16_t rawMs;                     // truncated millis() of last raw change
+  uint16_t levelMs;                   // truncated millis() of last debounced change
+};
+
+#if defined(BAKED_CONFIG)
+// Input config baked in at build time, see scripts/baked_config.py
+struct BakedInput
+{
+  uint8_t index;
+  uint8_t type;
+  bool invert;
+  bool disabled;
+  InputTiming timing;
+  uint16_t commandAddress;
+  uint16_t stateAddress;
+  bool failoverOnly;
+  uint16_t verifyMs;
+  uint16_t readProxyMs;
+  uint8_t secureKey;                  // 1-based into BAKED_SECURE_KEYS (0 = plain)
+  uint8_t hassEntity;
+};
+
+#include <BakedConfig.h>              // Generated tables
+#endif
+
 /*--------------------------- Global Variables ------------------------*/
 // Each bit corresponds to an MCP found on the IC2 bus
 uint8_t g_mcps_found = 0;
@@ -91,12 +366,85 @@ uint8_t g_mcps_found = 0;
 // Query current value of all bi-stable inputs
 bool g_queryInputs = false;
 
+// Input config currently applied, and the staging copy being parsed into
+InputConfig g_inputConfig[MCP_COUNT];
+InputConfig g_inputConfigStaged[MCP_COUNT];
+
+#if !defined(NO_HASS)
 // Publish Home Assistant self-discovery config for each input
 bool g_hassDiscoveryPublished[MAX_INPUT_COUNT];
 
+// Publish Home Assistant self-discovery config for each KNX actuator entity
+bool g_hassKnxDiscoveryPublished[MAX_INPUT_COUNT];
+
+// Set when any discovery config needs (re)publishing, e.g. when HA comes online
+bool g_hassDiscoveryPending = true;
+uint32_t g_hassDiscoveryLastMs = 0;
+#endif
+
+// MQTT topic layout for input events
+uint8_t g_eventTopicLayout = EVENT_TOPIC_STATUS;
+
+// Pins scanned with custom timing (instead of by the input handler) for each MCP
+uint16_t   g_timedMask[MCP_COUNT];
+TimedInput g_timedInputs[MAX_INPUT_COUNT];
+
+// Pins decoded by the fast rotary scan (pairs of ROTARY inputs) for each MCP
+uint16_t g_rotaryMask[MCP_COUNT];
+
+// Last A/B state (0xFF if unknown) and accumulated transitions for each encoder
+uint8_t  g_rotaryState[MCP_COUNT][MCP_PIN_COUNT / 2];
+int8_t   g_rotarySteps[MCP_COUNT][MCP_PIN_COUNT / 2];
+uint32_t g_rotaryTransitions = 0;
+uint32_t g_rotaryInvalid = 0;
+uint32_t g_rotaryOverruns = 0;
+
+// Detents (+ve up) decoded by the rotary task, waiting for the main loop
+int8_t   g_rotaryDetents[MCP_COUNT][MCP_PIN_COUNT / 2];
+portMUX_TYPE g_rotaryMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Held for every MCP access, and by the rotary task while decoding
+SemaphoreHandle_t g_mcpMutex;
+
+#if !defined(NO_REST)
+// Raw MCP sample words and their time since the trigger edge
+uint8_t  g_captureState = CAPTURE_IDLE;
+uint8_t  g_captureIndex = 0;
+uint16_t g_captureCount = 0;
+uint16_t g_captureWord[CAPTURE_SAMPLES];
+uint32_t g_captureUs[CAPTURE_SAMPLES];
+#endif
+
+// Structured log events waiting to be flushed (oldest at the head)
+LogEntry g_logBuffer[LOG_BUFFER_SIZE];
+uint8_t  g_logHead = 0;
+uint8_t  g_logCount = 0;
+uint32_t g_logOverwritten = 0;
+uint32_t g_logFlushMs = 0;
+
+// Per-ID rate limiting of log events, anything over the limit is counted
+uint32_t g_logWindowMs = 0;
+uint8_t  g_logWindowCount[LOG_ID_COUNT];
+uint16_t g_logSuppressed[LOG_ID_COUNT];
+
+// MQTT publish accounting (latency histogram is per telemetry period)
+MqttStats mqttStats;
+
+// Synthetic MQTT load
+#if defined(MQTT_BENCHMARK)
+MqttBenchmark mqttBenchmark(MQTT_BENCHMARK_MAX_RATE, MQTT_BENCHMARK_MAX_MS, MQTT_BENCHMARK_PER_LOOP);
+#endif
+
+// Longest loop() since the last telemetry was published
+uint32_t g_loopMaxUs = 0;
+uint32_t g_telemetryLastMs = 0;
+
 // Force KNX failover flag
 bool g_forceFailover = false;
 
+// KNX physical address of this device (needed to build secure telegrams)
+uint16_t g_knxDeviceAddress = KNX_DEFAULT_ADDRESS;
+
 // KNX config for every input
 KnxConfig g_knxConfig[MAX_INPUT_COUNT];
 
@@ -108,6 +456,70 @@ uint8_t  g_knxReadQueueTailIdx = 0;
 uint16_t g_knxReadWaitAddress = 0;
 uint32_t g_knxReadWaitSince = 0;
 
+// A queue for telegrams to be sent from the main loop
+KnxTxItem g_knxTxQueue[KNX_TX_QUEUE_SIZE];
+uint8_t   g_knxTxQueueHeadIdx = 0;
+uint8_t   g_knxTxQueueTailIdx = 0;
+uint32_t  g_knxTxQueueDropped = 0;
+
+// Frames waiting to be streamed to the BCU, and frames the BCU has yet to confirm
+KnxTxFrame g_knxTxFrames[KNX_TX_FRAME_QUEUE_SIZE];
+uint8_t   g_knxTxFrameHeadIdx = 0;
+uint8_t   g_knxTxFrameTailIdx = 0;
+uint8_t   g_knxTxInFlight = 0;
+uint32_t  g_knxTxInFlightSince = 0;
+uint32_t  g_knxTxFramesSent = 0;
+uint32_t  g_knxTxNacks = 0;
+uint32_t  g_knxTxTimeouts = 0;
+
+// When the last frame was written to the UART, and how long it takes to leave
+uint32_t  g_knxTxUartSinceUs = 0;
+uint32_t  g_knxTxUartBusyUs = 0;
+
+// BCU health, the read scheduler is paused while the BCU is down
+bool     g_knxBcuDown = false;
+uint8_t  g_knxBcuFailures = 0;
+uint32_t g_knxBcuDownSince = 0;
+uint32_t g_knxBcuRetryMs = 0;
+uint32_t g_knxBcuBackoffMs = KNX_BCU_BACKOFF_MIN_MS;
+uint32_t g_knxBcuResets = 0;
+uint32_t g_knxBcuDowntimeMs = 0;
+
+// Power-on broadcast of bi-stable input states (once per boot)
+bool     g_knxBroadcastEnabled = false;
+bool     g_knxBroadcastDone = false;
+bool     g_knxBroadcastCapture = false;
+uint32_t g_knxBroadcastArmedMs = 0;
+uint32_t g_knxBroadcastLastMs = 0;
+uint8_t  g_knxBroadcastState[MAX_INPUT_COUNT];
+uint8_t  g_knxBroadcastRemaining = 0;
+uint32_t g_knxBroadcastSent = 0;
+
+// Recently seen telegrams, oldest source/target pair overwritten first
+KnxSeenTelegram g_knxSeen[KNX_DEDUP_SIZE];
+uint8_t  g_knxSeenIdx = 0;
+uint32_t g_knxDuplicates = 0;
+
+// Reads answered from our cached state, and how much sooner than the actuator
+uint32_t g_knxReadProxyMaxAgeMs = KNX_READ_PROXY_MAX_AGE_MS;
+uint32_t g_knxReadsProxied = 0;
+uint32_t g_knxReadProxySavedMs = 0;
+
+// Last time we saw (or sent) a telegram on the bus
+uint32_t g_knxBusActivityMs = 0;
+
+// When the head of the read queue started waiting for the bus to go idle
+uint32_t g_knxReadHeldSince = 0;
+uint32_t g_knxReadsDeferred = 0;
+
+// Reads we didn't need to send as another device read (or published) the state
+uint32_t g_knxReadsSaved = 0;
+
+// Actuator verification counters
+uint8_t  g_knxVerifyPending = 0;
+uint32_t g_knxVerifyRetries = 0;
+uint32_t g_knxVerifyFailures = 0;
+
 /*--------------------------- Instantiate Globals ---------------------*/
 // I/O buffers
 Adafruit_MCP23X17 mcp23017[MCP_COUNT];
@@ -115,13 +527,139 @@ Adafruit_MCP23X17 mcp23017[MCP_COUNT];
 // Input handlers
 OXRS_Input oxrsInput[MCP_COUNT];
 
+// Input events waiting to be published (bi-stable inputs coalesced, security
+// events displace others and are only dropped if the queue is all security)
+EventQueue eventQueue((1 << CONTACT) | (1 << SWITCH), (1 << SECURITY));
+
+#if !defined(NO_HASS)
 // Home Assistant self-discovery
 OXRS_HASS hass(oxrs.getMQTT());
+#endif
 
 // KNX BCU on Serial2
 KnxTpUart knx(&Serial2, KNX_DEFAULT_ADDRESS);
 
+// KNX Data Secure
+KnxSecure knxSecure;
+
 /*--------------------------- Program ---------------------------------*/
+/**
+  Logging
+*/
+void logEvent(uint8_t id, uint32_t arg = 0)
+{
+  // Start a new rate limiting window
+  if ((millis() - g_logWindowMs) >= LOG_RATE_WINDOW_MS)
+  {
+    memset(g_logWindowCount, 0, sizeof(g_logWindowCount));
+    g_logWindowMs = millis();
+  }
+
+  // A chattering fault only gets a few entries, the rest are just counted
+  if (g_logWindowCount[id] >= LOG_RATE_LIMIT)
+  {
+    if (g_logSuppressed[id] < UINT16_MAX) { g_logSuppressed[id]++; }
+    return;
+  }
+
+  g_logWindowCount[id]++;
+
+  // Overwrite the oldest entry if nothing has been flushed for a while
+  if (g_logCount == LOG_BUFFER_SIZE)
+  {
+    g_logHead = (g_logHead + 1) % LOG_BUFFER_SIZE;
+    g_logCount--;
+    g_logOverwritten++;
+  }
+
+  LogEntry * entry = &g_logBuffer[(g_logHead + g_logCount) % LOG_BUFFER_SIZE];
+  entry->ms = millis();
+  entry->arg = arg;
+  entry->id = id;
+  g_logCount++;
+}
+
+bool flushLog(uint8_t count)
+{
+#if defined(NO_MQTT_LOGGER)
+  // One compact line per entry, formatted on the host
+  for (uint8_t i = 0; i < count; i++)
+  {
+    LogEntry * entry = &g_logBuffer[(g_logHead + i) % LOG_BUFFER_SIZE];
+    logger.printf("[log] %lu %u %lu\n", (unsigned long)entry->ms, entry->id, (unsigned long)entry->arg);
+  }
+
+  for (uint8_t id = 0; id < LOG_ID_COUNT; id++)
+  {
+    if (g_logSuppressed[id] > 0)
+    {
+      logger.printf("[log] suppressed %u %u\n", id, g_logSuppressed[id]);
+    }
+  }
+
+  return true;
+#else
+  JsonDocument json;
+
+  // Each entry is [ms, id, arg]
+  JsonArray entries = json["log"].to<JsonArray>();
+  for (uint8_t i = 0; i < count; i++)
+  {
+    LogEntry * entry = &g_logBuffer[(g_logHead + i) % LOG_BUFFER_SIZE];
+
+    JsonArray entryJson = entries.add<JsonArray>();
+    entryJson.add(entry->ms);
+    entryJson.add(entry->id);
+    entryJson.add(entry->arg);
+  }
+
+  // Each suppressed count is [id, count]
+  JsonArray suppressed = json["suppressed"].to<JsonArray>();
+  for (uint8_t id = 0; id < LOG_ID_COUNT; id++)
+  {
+    if (g_logSuppressed[id] > 0)
+    {
+      JsonArray suppressedJson = suppressed.add<JsonArray>();
+      suppressedJson.add(id);
+      suppressedJson.add(g_logSuppressed[id]);
+    }
+  }
+
+  char topic[64];
+  oxrs.getMQTT()->getStatusTopic(topic);
+  strcat(topic, "/log");
+
+  return oxrs.getMQTT()->publish(json.as<JsonVariant>(), topic, false);
+#endif
+}
+
+void loopLog()
+{
+  // Flush in batches, never from the path that logged the event
+  if ((millis() - g_logFlushMs) < LOG_FLUSH_MS)
+    return;
+
+  g_logFlushMs = millis();
+
+  bool suppressed = false;
+  for (uint8_t id = 0; id < LOG_ID_COUNT; id++)
+  {
+    if (g_logSuppressed[id] > 0) { suppressed = true; }
+  }
+
+  if (g_logCount == 0 && !suppressed)
+    return;
+
+  // Keep everything for the next flush if this one fails
+  uint8_t count = min(g_logCount, (uint8_t)LOG_FLUSH_MAX);
+  if (!flushLog(count))
+    return;
+
+  g_logHead = (g_logHead + count) % LOG_BUFFER_SIZE;
+  g_logCount -= count;
+  memset(g_logSuppressed, 0, sizeof(g_logSuppressed));
+}
+
 uint8_t getMaxIndex()
 {
   // Count how many MCPs were found
@@ -158,7 +696,7 @@ uint8_t parseInputType(const char * inputType)
   if (strcmp(inputType, "switch")   == 0) { return SWITCH; }
   if (strcmp(inputType, "toggle")   == 0) { return TOGGLE; }
 
-  oxrs.println(F("[knx] invalid input type"));
+  logEvent(LOG_INVALID_INPUT_TYPE);
   return INVALID_INPUT_TYPE;
 }
 
@@ -286,168 +824,344 @@ void getEventType(char eventType[], uint8_t type, uint8_t state)
   }
 }
 
-void setInputType(uint8_t mcp, uint8_t pin, uint8_t inputType)
+void createEventTopicLayoutEnum(JsonObject parent)
 {
-  // Configure the display (type constant from LCD library)
-  #if defined(OXRS_LCD_ENABLE)
-  switch (inputType)
-  {
-    case SECURITY:
-      oxrs.getLCD()->setPinType(mcp, pin, PIN_TYPE_SECURITY);
-      break;
-    default:
-      oxrs.getLCD()->setPinType(mcp, pin, PIN_TYPE_DEFAULT);
-      break;
-  }
-  #endif
-
-  // Pass this update to the input handler
-  oxrsInput[mcp].setType(pin, inputType);
+  JsonArray layoutEnum = parent["enum"].to<JsonArray>();
+  
+  layoutEnum.add("status");
+  layoutEnum.add("type");
+  layoutEnum.add("event");
 }
 
-void setInputInvert(uint8_t mcp, uint8_t pin, int invert)
+uint8_t parseEventTopicLayout(const char * layout)
 {
-  // Configure the display
-  #if defined(OXRS_LCD_ENABLE)
-  oxrs.getLCD()->setPinInvert(mcp, pin, invert);
-  #endif
+  if (layout == NULL) { return EVENT_TOPIC_STATUS; }
+  if (strcmp(layout, "type")  == 0) { return EVENT_TOPIC_TYPE; }
+  if (strcmp(layout, "event") == 0) { return EVENT_TOPIC_EVENT; }
 
-  // Pass this update to the input handler
-  oxrsInput[mcp].setInvert(pin, invert);
+  return EVENT_TOPIC_STATUS;
 }
 
-void setInputDisabled(uint8_t mcp, uint8_t pin, int disabled)
+char * getEventTopic(char topic[], const char * inputType, const char * eventType)
 {
-  // Configure the display
-  #if defined(OXRS_LCD_ENABLE)
-  oxrs.getLCD()->setPinDisabled(mcp, pin, disabled);
-  #endif
+  // Start with the device status topic, then add type/event levels
+  oxrs.getMQTT()->getStatusTopic(topic);
+
+  if (g_eventTopicLayout >= EVENT_TOPIC_TYPE)
+  {
+    strcat(topic, "/");
+    strcat(topic, inputType);
+  }
+
+  if (g_eventTopicLayout >= EVENT_TOPIC_EVENT && eventType != NULL)
+  {
+    strcat(topic, "/");
+    strcat(topic, eventType);
+  }
 
-  // Pass this update to the input handler
-  oxrsInput[mcp].setDisabled(pin, disabled);
+  return topic;
 }
 
-void setDefaultInputType(uint8_t inputType)
+bool publishEventJson(JsonVariant json, const char * inputType, const char * eventType)
 {
-  // Set all pins on all MCPs to this default input type
-  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
-  {
-    if (bitRead(g_mcps_found, mcp) == 0)
-      continue;
+  uint32_t startUs = micros();
+  bool success;
 
-    for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
-    {
-      setInputType(mcp, pin, inputType);
-    }
+  if (g_eventTopicLayout == EVENT_TOPIC_STATUS)
+  {
+    success = oxrs.publishStatus(json);
+  }
+  else
+  {
+    char topic[96];
+    success = oxrs.getMQTT()->publish(json, getEventTopic(topic, inputType, eventType), false);
   }
+
+  mqttStats.record(success, micros() - startUs);
+  return success;
 }
 
-/**
-  KNX
-*/
-bool knxTelegramCheck(KnxTelegram * telegram)
+#if !defined(NO_HASS)
+void createHassEntityEnum(JsonObject parent)
 {
-  // Check this is a message sent to a target group 
-  if (!telegram->isTargetGroup())
-    return false;
+  JsonArray entityEnum = parent["enum"].to<JsonArray>();
+  
+  entityEnum.add("none");
+  entityEnum.add("switch");
+  entityEnum.add("light");
+}
 
-  // Get the telegram address to save looking up for each loop iteration
-  uint16_t targetAddress = telegram->getTargetGroupAddress();
+uint8_t parseHassEntity(const char * entity)
+{
+  if (entity == NULL) { return HASS_ENTITY_NONE; }
+  if (strcmp(entity, "switch") == 0) { return HASS_ENTITY_SWITCH; }
+  if (strcmp(entity, "light")  == 0) { return HASS_ENTITY_LIGHT; }
 
-  // Ensure we show interest where required, so an ACK can be sent 
-  for (uint8_t i = 0; i < MAX_INPUT_COUNT; i++)
-  {
-    if (g_knxConfig[i].stateAddress == targetAddress)
-    {
-      return true;
-    }
-  }
+  return HASS_ENTITY_NONE;
+}
+#endif
 
-  return false;
+void setInputType(uint8_t mcp, uint8_t pin, uint8_t inputType)
+{
+  g_inputConfigStaged[mcp].type[pin] = inputType;
 }
 
-void knxTelegram(KnxTelegram * telegram, bool interesting)
+void setInputInvert(uint8_t mcp, uint8_t pin, int invert)
 {
-  // Ignore any telegrams we didn't identify as being interesting
-  if (!interesting)
-    return;
+  bitWrite(g_inputConfigStaged[mcp].invert, pin, invert);
+}
 
-  // Only interested in write/response telegrams - i.e. a device publishing state 
-  if (telegram->getCommand() != KNX_COMMAND_WRITE && telegram->getCommand() != KNX_COMMAND_ANSWER)
-    return;
+void setInputDisabled(uint8_t mcp, uint8_t pin, int disabled)
+{
+  bitWrite(g_inputConfigStaged[mcp].disabled, pin, disabled);
+}
 
-  // Only interested in 1-bit (bool) values
-  if (telegram->getPayloadLength() != 2)
-    return;
+void setInputTiming(uint8_t mcp, uint8_t pin, JsonVariant json)
+{
+  InputTiming * timing = &g_inputConfigStaged[mcp].timing[pin];
 
-  // Get the telegram address/value to save looking up for each loop iteration
-  uint16_t targetAddress = telegram->getTargetGroupAddress();
-  bool value = telegram->getBool();
+  if (json.containsKey("debounceMs"))
+  {
+    timing->debounce = min(json["debounceMs"].as<uint16_t>(), (uint16_t)UINT8_MAX);
+  }
 
-  // Update our internal state for any inputs with this stateAddress
-  for (uint8_t i = 0; i < MAX_INPUT_COUNT; i++)
+  // Anything under one unit is still custom timing (0 means the default)
+  if (json.containsKey("holdMs"))
   {
-    if (g_knxConfig[i].stateAddress == targetAddress)
-    {
-      g_knxConfig[i].state = value;
-      g_knxConfig[i].lastStateUpdateMs = millis();
-    }
+    uint16_t holdMs = json["holdMs"].as<uint16_t>();
+    timing->hold = holdMs == 0 ? 0 : max(min(holdMs / INPUT_HOLD_UNIT_MS, UINT8_MAX), 1);
   }
 
-  // If this was the address we were waiting on, then clear so we can move onto
-  // the next item in the queue
-  if (g_knxReadWaitAddress == targetAddress)
+  if (json.containsKey("multiClickMs"))
   {
-    g_knxReadWaitAddress = 0;
-    g_knxReadWaitSince = 0;
+    uint16_t clickMs = json["multiClickMs"].as<uint16_t>();
+    timing->click = clickMs == 0 ? 0 : max(min(clickMs / INPUT_CLICK_UNIT_MS, UINT8_MAX), 1);
   }
 }
 
-bool isQueueEmpty()
+void republishHassDiscovery()
 {
-  return g_knxReadQueueHeadIdx == g_knxReadQueueTailIdx;
+#if !defined(NO_HASS)
+  memset(g_hassDiscoveryPublished, 0, sizeof(g_hassDiscoveryPublished));
+
+  for (uint8_t i = 0; i < MAX_INPUT_COUNT; i++)
+  {
+    g_hassKnxDiscoveryPublished[i] = g_knxConfig[i].hassEntity == HASS_ENTITY_NONE;
+  }
+
+  g_hassDiscoveryPending = true;
+#endif
 }
 
-bool isQueued(uint16_t address)
+uint16_t getTimedInputs(InputConfig * config)
 {
-  if (isQueueEmpty())
-    return false;
+  uint16_t mask = 0;
 
-  // Check if the queue has wrapped (i.e. the head is before the tail)
-  if (g_knxReadQueueTailIdx < g_knxReadQueueHeadIdx)
-  {
-    // Check from the tail to the head
-    for (uint16_t i = g_knxReadQueueTailIdx; i < g_knxReadQueueHeadIdx; i++)
-    {
-      if (g_knxReadQueue[i] == address)
-        return true;
-    }
-  }
-  else
+  // Security and rotary inputs are always left to their own decoders
+  for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
   {
-    // Check from the tail to the end of the queue
-    for (uint16_t i = g_knxReadQueueTailIdx; i < KNX_READ_QUEUE_SIZE; i++)
-    {
-      if (g_knxReadQueue[i] == address)
-        return true;
-    }
+    if (config->type[pin] == SECURITY || config->type[pin] == ROTARY)
+      continue;
 
-    // Check from the start of the queue to the head
-    for (uint16_t i = 0; i < g_knxReadQueueHeadIdx; i++)
-    {
-      if (g_knxReadQueue[i] == address)
-        return true;
-    }
+    InputTiming * timing = &config->timing[pin];
+    if (timing->debounce == 0 && timing->hold == 0 && timing->click == 0)
+      continue;
+
+    bitSet(mask, pin);
   }
 
-  return false;
+  return mask;
 }
 
-void flushQueue()
+void updateRotaryMask(uint8_t mcp)
 {
-  // Clear the queue
-  g_knxReadQueueHeadIdx = 0;
-  g_knxReadQueueTailIdx = 0;
+  InputConfig * config = &g_inputConfig[mcp];
+  uint16_t mask = 0;
+
+  // Encoders are wired to pairs of pins, both configured as ROTARY
+  for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin += 2)
+  {
+    if (config->type[pin] != ROTARY || config->type[pin + 1] != ROTARY)
+      continue;
+
+    if (bitRead(config->disabled, pin) || bitRead(config->disabled, pin + 1))
+      continue;
+
+    mask |= (0b11 << pin);
+  }
+
+  // Start decoding any changed encoders from their next reading
+  if (mask != g_rotaryMask[mcp])
+  {
+    xSemaphoreTake(g_mcpMutex, portMAX_DELAY);
+    memset(g_rotaryState[mcp], 0xFF, sizeof(g_rotaryState[mcp]));
+    memset(g_rotarySteps[mcp], 0, sizeof(g_rotarySteps[mcp]));
+    memset(g_rotaryDetents[mcp], 0, sizeof(g_rotaryDetents[mcp]));
+    g_rotaryMask[mcp] = mask;
+    xSemaphoreGive(g_mcpMutex);
+  }
+}
+
+void stageInputConfig()
+{
+  // Start from what is currently applied
+  memcpy(g_inputConfigStaged, g_inputConfig, sizeof(g_inputConfig));
+}
+
+void commitInputConfig()
+{
+  uint32_t startUs = micros();
+  uint8_t changed = 0;
+
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    if (bitRead(g_mcps_found, mcp) == 0)
+      continue;
+
+    InputConfig * applied = &g_inputConfig[mcp];
+    InputConfig * staged = &g_inputConfigStaged[mcp];
+
+    // Nothing to do if nothing has changed on this MCP
+    if (memcmp(applied, staged, sizeof(InputConfig)) == 0)
+      continue;
+
+    uint16_t invertChanged = applied->invert ^ staged->invert;
+    uint16_t disabledChanged = applied->disabled ^ staged->disabled;
+
+    // Inputs with custom timing are disabled in the input handler
+    uint16_t timedStaged = getTimedInputs(staged);
+    uint16_t timedChanged = getTimedInputs(applied) ^ timedStaged;
+
+    for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+    {
+      bool typeChanged = applied->type[pin] != staged->type[pin];
+      bool timingChanged = memcmp(&applied->timing[pin], &staged->timing[pin], sizeof(InputTiming)) != 0;
+      if (!typeChanged && !timingChanged && !bitRead(invertChanged, pin) && !bitRead(disabledChanged, pin))
+        continue;
+
+      // Configure the display (type constant from LCD library)
+      #if defined(OXRS_LCD_ENABLE)
+      if (typeChanged)
+      {
+        oxrs.getLCD()->setPinType(mcp, pin, staged->type[pin] == SECURITY ? PIN_TYPE_SECURITY : PIN_TYPE_DEFAULT);
+      }
+      if (bitRead(invertChanged, pin))
+      {
+        oxrs.getLCD()->setPinInvert(mcp, pin, bitRead(staged->invert, pin));
+      }
+      if (bitRead(disabledChanged, pin))
+      {
+        oxrs.getLCD()->setPinDisabled(mcp, pin, bitRead(staged->disabled, pin));
+      }
+      #endif
+
+      // Pass this update to the input handler
+      if (typeChanged)
+      {
+        oxrsInput[mcp].setType(pin, staged->type[pin]);
+      }
+      if (bitRead(invertChanged, pin))
+      {
+        oxrsInput[mcp].setInvert(pin, bitRead(staged->invert, pin));
+      }
+      if (bitRead(disabledChanged, pin) || bitRead(timedChanged, pin))
+      {
+        oxrsInput[mcp].setDisabled(pin, bitRead(staged->disabled | timedStaged, pin));
+      }
+
+      // Start any timed input afresh from its next reading
+      memset(&g_timedInputs[(MCP_PIN_COUNT * mcp) + pin], 0, sizeof(TimedInput));
+
+      // Republish any Home Assistant discovery config for this input
+      #if !defined(NO_HASS)
+      g_hassDiscoveryPublished[(MCP_PIN_COUNT * mcp) + pin] = false;
+      g_hassDiscoveryPending = true;
+      #endif
+      changed++;
+    }
+
+    memcpy(applied, staged, sizeof(InputConfig));
+
+    // Inputs with custom timing are scanned by processTimedInputs()
+    g_timedMask[mcp] = timedStaged & ~staged->disabled;
+
+    // Encoder pairs are decoded by the fast rotary scan
+    updateRotaryMask(mcp);
+  }
+
+  if (changed > 0)
+  {
+    logger.print(F("[knx] input config applied to "));
+    logger.print(changed);
+    logger.print(F(" inputs in "));
+    logger.print(micros() - startUs);
+    logger.println(F("us"));
+  }
+}
+
+void setDefaultInputType(uint8_t inputType)
+{
+  // Set all pins on all MCPs to this default input type
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    if (bitRead(g_mcps_found, mcp) == 0)
+      continue;
+
+    for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+    {
+      setInputType(mcp, pin, inputType);
+    }
+  }
+}
+
+/**
+  KNX
+*/
+bool isQueueEmpty()
+{
+  return g_knxReadQueueHeadIdx == g_knxReadQueueTailIdx;
+}
+
+bool isQueued(uint16_t address)
+{
+  if (isQueueEmpty())
+    return false;
+
+  // Check if the queue has wrapped (i.e. the head is before the tail)
+  if (g_knxReadQueueTailIdx < g_knxReadQueueHeadIdx)
+  {
+    // Check from the tail to the head
+    for (uint16_t i = g_knxReadQueueTailIdx; i < g_knxReadQueueHeadIdx; i++)
+    {
+      if (g_knxReadQueue[i] == address)
+        return true;
+    }
+  }
+  else
+  {
+    // Check from the tail to the end of the queue
+    for (uint16_t i = g_knxReadQueueTailIdx; i < KNX_READ_QUEUE_SIZE; i++)
+    {
+      if (g_knxReadQueue[i] == address)
+        return true;
+    }
+
+    // Check from the start of the queue to the head
+    for (uint16_t i = 0; i < g_knxReadQueueHeadIdx; i++)
+    {
+      if (g_knxReadQueue[i] == address)
+        return true;
+    }
+  }
+
+  return false;
+}
+
+void flushQueue()
+{
+  // Clear the queue
+  g_knxReadQueueHeadIdx = 0;
+  g_knxReadQueueTailIdx = 0;
 
   // Clear the timeout timer
   g_knxReadWaitAddress = 0;
@@ -473,6 +1187,32 @@ void pushQueue(uint16_t address)
   }
 }
 
+bool removeQueue(uint16_t address)
+{
+  bool removed = false;
+
+  // Walk from the tail to the head, compacting out any matching entries
+  uint8_t idx = g_knxReadQueueTailIdx;
+  uint8_t keepIdx = g_knxReadQueueTailIdx;
+  while (idx != g_knxReadQueueHeadIdx)
+  {
+    if (g_knxReadQueue[idx] == address)
+    {
+      removed = true;
+    }
+    else
+    {
+      g_knxReadQueue[keepIdx] = g_knxReadQueue[idx];
+      keepIdx = (keepIdx + 1) % KNX_READ_QUEUE_SIZE;
+    }
+
+    idx = (idx + 1) % KNX_READ_QUEUE_SIZE;
+  }
+
+  g_knxReadQueueHeadIdx = keepIdx;
+  return removed;
+}
+
 uint16_t popQueue()
 {
   if (isQueueEmpty())
@@ -491,535 +1231,2462 @@ uint16_t popQueue()
   return address;
 }
 
-void initialiseKnx()
+void publishTelemetry()
 {
-  // Listen for telegrams addressed to our KNX state addresses 
-  knx.setTelegramCheckCallback(knxTelegramCheck);
-  knx.setKnxTelegramCallback(knxTelegram);
+  uint32_t downtimeMs = g_knxBcuDowntimeMs;
+  if (g_knxBcuDown)
+  {
+    downtimeMs += millis() - g_knxBcuDownSince;
+  }
 
-  // Configure the second serial port on the ESP32 for the KNX BCU
-  oxrs.println(F("[knx] setting up Serial2 for KNX BCU..."));
-  oxrs.print(F(" - baud:   "));
-  oxrs.println(KNX_SERIAL_BAUD);
-  oxrs.print(F(" - config: "));
-  oxrs.println(KNX_SERIAL_CONFIG);
-  oxrs.print(F(" - rx pin: "));
-  oxrs.println(KNX_SERIAL_RX);
-  oxrs.print(F(" - tx pin: "));
-  oxrs.println(KNX_SERIAL_TX);
+  JsonDocument json;
+  JsonObject knxJson = json["knx"].to<JsonObject>();
+  knxJson["bcuOnline"] = !g_knxBcuDown;
+  knxJson["bcuResets"] = g_knxBcuResets;
+  knxJson["bcuDowntimeMs"] = downtimeMs;
+  knxJson["txDropped"] = g_knxTxQueueDropped;
+  knxJson["txFrames"] = g_knxTxFramesSent;
+  knxJson["txNacks"] = g_knxTxNacks;
+  knxJson["txTimeouts"] = g_knxTxTimeouts;
+  knxJson["readsSaved"] = g_knxReadsSaved;
+  knxJson["readsDeferred"] = g_knxReadsDeferred;
+  knxJson["verifyRetries"] = g_knxVerifyRetries;
+  knxJson["verifyFailures"] = g_knxVerifyFailures;
+  knxJson["broadcastSent"] = g_knxBroadcastSent;
+  knxJson["duplicates"] = g_knxDuplicates;
+  knxJson["readsProxied"] = g_knxReadsProxied;
+  knxJson["readProxySavedMs"] = g_knxReadProxySavedMs;
+  knxJson["secureMacFailures"] = knxSecure.getMacFailures();
+  knxJson["secureReplayFailures"] = knxSecure.getReplayFailures();
+  knxJson["securePeerOverflows"] = knxSecure.getPeerOverflows();
+
+  JsonObject eventsJson = json["events"].to<JsonObject>();
+  eventsJson["queueHighWater"] = eventQueue.getHighWater();
+  eventsJson["coalesced"] = eventQueue.getCoalesced();
+  eventsJson["deferred"] = eventQueue.getDeferred();
+  eventsJson["dropped"] = eventQueue.getDropped();
+  eventsJson["securityDropped"] = eventQueue.getProtectedDropped();
+
+  JsonObject mqttJson = json["mqtt"].to<JsonObject>();
+  mqttJson["published"] = mqttStats.getPublished();
+  mqttJson["failed"] = mqttStats.getFailed();
+  mqttJson["maxLatencyUs"] = mqttStats.getMaxLatencyUs();
+  JsonArray latencyJson = mqttJson["latency"].to<JsonArray>();
+  for (uint8_t i = 0; i < MQTT_LATENCY_BUCKETS; i++)
+  {
+    latencyJson.add(mqttStats.getLatency(i));
+  }
 
-  Serial2.begin(KNX_SERIAL_BAUD, KNX_SERIAL_CONFIG, KNX_SERIAL_RX, KNX_SERIAL_TX);
+  JsonObject logJson = json["log"].to<JsonObject>();
+  logJson["overwritten"] = g_logOverwritten;
 
-  // Reset the UART connection on startup
-  if (knx.uartReset(KNX_RESET_TIMEOUT_MS))
+  JsonObject rotaryJson = json["rotary"].to<JsonObject>();
+  rotaryJson["transitions"] = g_rotaryTransitions;
+  rotaryJson["invalid"] = g_rotaryInvalid;
+  rotaryJson["overruns"] = g_rotaryOverruns;
+
+  json["loopMaxUs"] = g_loopMaxUs;
+
+  oxrs.publishTelemetry(json.as<JsonVariant>());
+  g_telemetryLastMs = millis();
+
+  // Peaks and histograms are per telemetry period
+  eventQueue.resetHighWater();
+  g_loopMaxUs = 0;
+  mqttStats.resetPeriod();
+}
+
+#if !defined(NO_HASS)
+char * getKnxStateTopic(char topic[])
+{
+  // Always <status>/knx, whatever the event topic layout, so actuator state
+  // never lands on a topic (or index) the input entities are watching
+  oxrs.getMQTT()->getStatusTopic(topic);
+  strcat(topic, "/knx");
+
+  return topic;
+}
+
+void publishKnxState(uint8_t index)
+{
+  // Calculate the port and channel for this index (all 1-based)
+  uint8_t port = ((index - 1) / 4) + 1;
+  uint8_t channel = index - ((port - 1) * 4);
+
+  // Not an input event, so use a separate key to avoid confusing consumers
+  const char * eventType = g_knxConfig[index - 1].state ? "on" : "off";
+
+  JsonDocument json;
+  json["port"] = port;
+  json["channel"] = channel;
+  json["index"] = index;
+  json["knxState"] = eventType;
+
+  uint32_t startUs = micros();
+  char topic[96];
+  bool success = oxrs.getMQTT()->publish(json.as<JsonVariant>(), getKnxStateTopic(topic), false);
+
+  mqttStats.record(success, micros() - startUs);
+}
+#endif
+
+void knxBcuDown()
+{
+  if (g_knxBcuDown)
+    return;
+
+  g_knxBcuDown = true;
+  g_knxBcuDownSince = millis();
+  g_knxBcuRetryMs = millis();
+  g_knxBcuBackoffMs = KNX_BCU_BACKOFF_MIN_MS;
+
+  // Anything queued for the BCU is stale by the time it recovers (toggles
+  // and dims were worked out from state at the time), so discard it all
+  g_knxTxQueueDropped += (g_knxTxQueueHeadIdx + KNX_TX_QUEUE_SIZE - g_knxTxQueueTailIdx) % KNX_TX_QUEUE_SIZE;
+  g_knxTxQueueTailIdx = g_knxTxQueueHeadIdx;
+  g_knxTxFrameTailIdx = g_knxTxFrameHeadIdx;
+  g_knxTxInFlight = 0;
+
+  logEvent(LOG_BCU_DOWN);
+  publishTelemetry();
+}
+
+void knxBcuUp()
+{
+  if (!g_knxBcuDown)
+    return;
+
+  uint32_t downtimeMs = millis() - g_knxBcuDownSince;
+
+  g_knxBcuDown = false;
+  g_knxBcuFailures = 0;
+  g_knxBcuDowntimeMs += downtimeMs;
+
+  logEvent(LOG_BCU_UP, downtimeMs);
+  publishTelemetry();
+}
+
+void knxBcuConfirm(bool confirmed)
+{
+  // Any confirmation (or telegram received) shows the BCU is alive
+  if (confirmed)
   {
-    oxrs.println(F("[knx] UART reset OK"));
+    g_knxBcuFailures = 0;
+    return;
+  }
+
+  if (++g_knxBcuFailures < KNX_BCU_FAILURE_LIMIT)
+    return;
+
+  // Too many failures, probe the BCU with a (short) UART reset, which also
+  // discards any frames it was holding
+  g_knxBcuResets++;
+  g_knxTxInFlight = 0;
+  if (knx.uartReset(KNX_BCU_PROBE_MS))
+  {
+    g_knxBcuFailures = 0;
   }
   else
   {
-    oxrs.print(F("[knx] UART reset timed out after "));
-    oxrs.print(KNX_RESET_TIMEOUT_MS);
-    oxrs.println(F("ms"));
+    knxBcuDown();
   }
 }
 
-void loopKnx()
+bool isKnxBusIdle()
+{
+  return (millis() - g_knxBusActivityMs) > KNX_BUS_IDLE_MS;
+}
+
+uint8_t getKnxSecureKey(uint16_t address)
 {
-  // Check for any events on the KNX bus
-  knx.serialEvent();
+  // Find the KNX Data Secure key (if any) configured for this group address
+  for (uint8_t i = 0; i < MAX_INPUT_COUNT; i++)
+  {
+    if (g_knxConfig[i].secureKey == 0)
+      continue;
 
-  // Are we waiting on a read response?
-  if (g_knxReadWaitAddress == 0)
+    if (g_knxConfig[i].commandAddress == address || g_knxConfig[i].stateAddress == address)
+      return g_knxConfig[i].secureKey;
+  }
+
+  return 0;
+}
+
+void knxStreamFrames()
+{
+  // Keep the BCU fed, so the next frame is ready as soon as the bus is free
+  while (g_knxTxInFlight < KNX_TX_PIPELINE_DEPTH && g_knxTxFrameHeadIdx != g_knxTxFrameTailIdx)
   {
-    // If we are not waiting then check the queue
-    uint16_t address = popQueue();
-    if (address != 0)
-    {
-      // Something was on the queue so send a read request
-      knx.groupRead(address);
+    // Only give the UART one frame at a time, so anything time-critical the
+    // library sends (i.e. the ACK for a telegram to one of our addresses)
+    // never waits behind a second frame
+    if ((uint32_t)(micros() - g_knxTxUartSinceUs) < g_knxTxUartBusyUs)
+      return;
 
-      // Start the timeout timer
-      g_knxReadWaitAddress = address;
-      g_knxReadWaitSince = millis();
-    }
-    else
+    KnxTxFrame * frame = &g_knxTxFrames[g_knxTxFrameTailIdx];
+
+    // Never block the loop waiting on the UART, try again next time
+    if (Serial2.availableForWrite() < frame->size * 2)
+      return;
+
+    // Each byte is preceded by its TP-UART service byte
+    for (uint8_t i = 0; i < frame->size; i++)
     {
-      // Queue is empty so check if there are any addresses that have expired state
-      for (uint8_t i = 0; i < MAX_INPUT_COUNT; i++)
-      {
-        if ((millis() - g_knxConfig[i].lastStateUpdateMs) > KNX_STATE_EXPIRY_MS)
-        {
-          pushQueue(g_knxConfig[i].stateAddress);
-        }
-      }
+      Serial2.write((i == frame->size - 1 ? KNX_UART_DATA_END : KNX_UART_DATA_START) | i);
+      Serial2.write(frame->data[i]);
     }
-  }
-  else
-  {
-    // If we have timed out waiting for a response then re-queue and continue
-    if ((millis() - g_knxReadWaitSince) > KNX_READ_TIMEOUT_MS)
+
+    g_knxTxUartSinceUs = micros();
+    g_knxTxUartBusyUs = frame->size * 2 * KNX_UART_BYTE_US;
+
+    g_knxTxFrameTailIdx = (g_knxTxFrameTailIdx + 1) % KNX_TX_FRAME_QUEUE_SIZE;
+    g_knxTxFramesSent++;
+
+    if (g_knxTxInFlight++ == 0)
     {
-      // Push this address back onto the queue
-      pushQueue(g_knxReadWaitAddress);
-      
-      // Clear the timeout timer
-      g_knxReadWaitAddress = 0;
-      g_knxReadWaitSince = 0;
+      g_knxTxInFlightSince = millis();
     }
   }
 }
 
-void publishKnxEvent(uint8_t index, uint8_t type, uint8_t state)
+void knxTxConfirm(bool confirmed)
 {
-  // Get the KNX group address configured for this input (if any)...
-  uint16_t commandAddress = g_knxConfig[index - 1].commandAddress;
-  
-  // Ignore if no KNX command address configured  
-  if (commandAddress == 0)
+  // Ignore anything we weren't waiting on (e.g. after a UART reset)
+  if (g_knxTxInFlight == 0)
     return;
 
-  // Determine what type of KNX telegram to send...
-  switch (type)
+  g_knxTxInFlight--;
+  g_knxTxInFlightSince = millis();
+
+  // A negative confirm means nobody ACKed, but the BCU is alive either way
+  if (!confirmed)
   {
-    case BUTTON:
-      // Only handle single-press events, treat as TOGGLE
-      if (state == 1)
-      {
-        knx.groupWriteBool(commandAddress, !g_knxConfig[index - 1].state);
-      }
-      break;
-    case ROTARY:
-      // Send relative inc/dec dimming telegram (no internal state needed)
-      knx.groupWrite4BitDim(commandAddress, state == LOW_EVENT, 5);
-      break;
-    case CONTACT:
-    case SECURITY:
-    case SWITCH:
-      // Send boolean telegram (no internal state needed)
-      // CONTACT:   LOW_EVENT => open
-      // SECURITY:  LOW_EVENT => alarm  <-- what about TAMPER, FAULT, SHORT?
-      // SWITCH:    LOW_EVENT => on
-      knx.groupWriteBool(commandAddress, state == LOW_EVENT);
-      break;
-    case PRESS:
-    case TOGGLE:
-      // Send boolean telegram with toggled state
-      knx.groupWriteBool(commandAddress, !g_knxConfig[index - 1].state);
-      break;  
+    g_knxTxNacks++;
   }
+  knxBcuConfirm(true);
+
+  // Stream the next frame straight away
+  knxStreamFrames();
 }
 
-void createKnxValueEnum(JsonObject parent)
+void knxTxCheckTimeout()
 {
-  JsonArray valueEnum = parent["enum"].to<JsonArray>();
-  
-  valueEnum.add("on");
-  valueEnum.add("off");
-  valueEnum.add("up");
-  valueEnum.add("down");
+  if (g_knxTxInFlight == 0)
+    return;
+
+  if ((millis() - g_knxTxInFlightSince) < KNX_TX_CONFIRM_TIMEOUT_MS)
+    return;
+
+  // Missing confirmations could mean the BCU (or bus) has gone away
+  g_knxTxTimeouts++;
+  g_knxTxInFlight = 0;
+  knxBcuConfirm(false);
 }
 
-/**
-  Config handler
- */
-void setConfigSchema()
+void knxReceive()
 {
-  // Define our config schema
-  JsonDocument json;
-
-  JsonObject knxDeviceAddress = json["knxDeviceAddress"].to<JsonObject>();
-  knxDeviceAddress["title"] = "KNX Device Address";
-  knxDeviceAddress["description"] = "The physical address of this device on the KNX bus. Defaults to 1.1.244.";
-  knxDeviceAddress["type"] = "string";
-  knxDeviceAddress["pattern"] = "^\\d+\\.\\d+\\.\\d+$";
+  for (uint8_t i = 0; i < KNX_RX_PER_LOOP && Serial2.available(); i++)
+  {
+    // Take our transmit confirmations off the front of the stream, they
+    // can't be mistaken for a telegram control field
+    int data = Serial2.peek();
+    if (data == KNX_UART_CONFIRM_OK || data == KNX_UART_CONFIRM_FAIL)
+    {
+      Serial2.read();
+      knxTxConfirm(data == KNX_UART_CONFIRM_OK);
+      continue;
+    }
 
-  JsonObject defaultInputType = json["defaultInputType"].to<JsonObject>();
-  defaultInputType["title"] = "Default Input Type";
-  defaultInputType["description"] = "Set the default input type for anything without explicit configuration below. Defaults to ‘switch’.";
-  createInputTypeEnum(defaultInputType);
+    // Only hand the library a telegram, it reads until it finds one so
+    // would swallow any confirmations queued up behind other bytes
+    if ((data & KNX_FRAME_CONTROL_MASK) == KNX_FRAME_CONTROL_STD)
+    {
+      knx.serialEvent();
+    }
+    else
+    {
+      // Anything else (e.g. a state indication) is of no interest
+      Serial2.read();
+    }
+  }
+}
 
-  JsonObject inputs = json["inputs"].to<JsonObject>();
-  inputs["title"] = "Input Configuration";
-  inputs["description"] = "Add configuration for each input in use on your device. The 1-based index specifies which input you wish to configure. The type defines how an input is monitored and what events are emitted. The KNX group addresses must be in standard 3-level format, e.g. 1/2/3.";
-  inputs["type"] = "array";
-  
-  JsonObject items = inputs["items"].to<JsonObject>();
-  items["type"] = "object";
+void knxSendFrame(uint16_t address, const uint8_t * payload, uint8_t payloadLength)
+{
+  if (payloadLength == 0 || payloadLength > KNX_FRAME_MAX_PAYLOAD)
+    return;
 
-  JsonObject properties = items["properties"].to<JsonObject>();
+  // Check there is room, the queue is full if the head would hit the tail
+  uint8_t headIdx = (g_knxTxFrameHeadIdx + 1) % KNX_TX_FRAME_QUEUE_SIZE;
+  if (headIdx == g_knxTxFrameTailIdx)
+  {
+    g_knxTxQueueDropped++;
+    logEvent(LOG_TX_QUEUE_FULL, address);
+    return;
+  }
 
-  JsonObject index = properties["index"].to<JsonObject>();
-  index["title"] = "Index";
-  index["type"] = "integer";
-  index["minimum"] = 1;
-  index["maximum"] = getMaxIndex();
+  uint8_t * frame = g_knxTxFrames[g_knxTxFrameHeadIdx].data;
+  uint8_t size = 0;
 
-  JsonObject type = properties["type"].to<JsonObject>();
-  type["title"] = "Type";
-  createInputTypeEnum(type);
+  // Standard frame header (group address, routing counter 6)
+  frame[size++] = KNX_FRAME_CONTROL;
+  frame[size++] = g_knxDeviceAddress >> 8;
+  frame[size++] = g_knxDeviceAddress & 0xFF;
+  frame[size++] = address >> 8;
+  frame[size++] = address & 0xFF;
+  frame[size++] = 0xE0 | ((payloadLength - 1) & 0x0F);
 
-  JsonObject invert = properties["invert"].to<JsonObject>();
-  invert["title"] = "Invert";
-  invert["type"] = "boolean";
+  memcpy(&frame[size], payload, payloadLength);
+  size += payloadLength;
 
-  JsonObject disabled = properties["disabled"].to<JsonObject>();
-  disabled["title"] = "Disabled";
-  disabled["type"] = "boolean";
+  // Checksum is the inverted XOR of all bytes
+  uint8_t checksum = 0;
+  for (uint8_t i = 0; i < size; i++) { checksum ^= frame[i]; }
+  frame[size++] = ~checksum;
 
-  JsonObject knxCommandAddress = properties["knxCommandAddress"].to<JsonObject>();
-  knxCommandAddress["title"] = "KNX Command Address";
-  knxCommandAddress["type"] = "string";
-  knxCommandAddress["pattern"] = "^\\d+\\/\\d+\\/\\d+$";
+  g_knxTxFrames[g_knxTxFrameHeadIdx].size = size;
+  g_knxTxFrameHeadIdx = headIdx;
 
-  JsonObject knxStateAddress = properties["knxStateAddress"].to<JsonObject>();
-  knxStateAddress["title"] = "KNX State Address";
-  knxStateAddress["type"] = "string";
-  knxStateAddress["pattern"] = "^\\d+\\/\\d+\\/\\d+$";
+  // Start streaming now if the BCU has room
+  knxStreamFrames();
+}
 
-  JsonObject knxFailoverOnly = properties["knxFailoverOnly"].to<JsonObject>();
-  knxFailoverOnly["title"] = "KNX Failover Only";
-  knxFailoverOnly["type"] = "boolean";
+void knxSendSecure(uint16_t address, uint8_t secureKey, const uint8_t * apdu, uint8_t apduLength)
+{
+  uint8_t secureApdu[KNX_FRAME_MAX_PAYLOAD];
+  uint8_t secureLength = knxSecure.encrypt(secureKey, g_knxDeviceAddress, address, apdu, apduLength, secureApdu);
 
-  JsonArray required = items["required"].to<JsonArray>();
-  required.add("index");
+  if (secureLength == 0)
+  {
+    logEvent(LOG_SECURE_ENCRYPT_FAILED, address);
+    return;
+  }
 
-  // Add any Home Assistant config
-  hass.setConfigSchema(json);
+  knxSendFrame(address, secureApdu, secureLength);
+}
 
-  // Pass our config schema down to the hardware library
-  oxrs.setConfigSchema(json.as<JsonVariant>());
+void knxSendApdu(uint16_t address, const uint8_t * apdu, uint8_t apduLength)
+{
+  uint8_t secureKey = getKnxSecureKey(address);
+  if (secureKey == 0)
+  {
+    knxSendFrame(address, apdu, apduLength);
+  }
+  else
+  {
+    knxSendSecure(address, secureKey, apdu, apduLength);
+  }
 }
 
-uint16_t parseDeviceAddress(const char * address)
+void knxGroupWriteBool(uint16_t address, bool value)
 {
-  const char * delimiter = ".";
+  // Our own writes are bus traffic too
+  g_knxBusActivityMs = millis();
+
+  // Don't queue frames for a BCU we know is down
+  if (g_knxBcuDown)
+    return;
+
+  // A_GroupValue_Write with 6-bit data
+  uint8_t apdu[2] = { 0x00, (uint8_t)(0x80 | (value ? 0x01 : 0x00)) };
+  knxSendApdu(address, apdu, sizeof(apdu));
+}
 
-  char buffer[strlen(address) + 1];
-  strcpy(buffer, address);
+void knxGroupWrite4BitDim(uint16_t address, bool direction, uint8_t steps)
+{
+  // Our own writes are bus traffic too
+  g_knxBusActivityMs = millis();
 
-  char * token = strtok(buffer, delimiter);
-  int area = atoi(token);
-  token = strtok(NULL, delimiter);
-  int line = atoi(token);
-  token = strtok(NULL, delimiter);
-  int member = atoi(token);
+  if (g_knxBcuDown)
+    return;
 
-  return KNX_IA(area, line, member);
+  // A_GroupValue_Write with 6-bit data (direction bit + step code)
+  uint8_t apdu[2] = { 0x00, (uint8_t)(0x80 | (direction ? 0x08 : 0x00) | (steps & 0x07)) };
+  knxSendApdu(address, apdu, sizeof(apdu));
 }
 
-uint16_t parseGroupAddress(const char * address)
+void knxGroupAnswerBool(uint16_t address, bool value)
 {
-  const char * delimiter = "/";
+  // Our own answers are bus traffic too
+  g_knxBusActivityMs = millis();
+
+  if (g_knxBcuDown)
+    return;
 
-  char buffer[strlen(address) + 1];
-  strcpy(buffer, address);
+  // A_GroupValue_Response with 6-bit data
+  uint8_t apdu[2] = { 0x00, (uint8_t)(0x40 | (value ? 0x01 : 0x00)) };
+  knxSendApdu(address, apdu, sizeof(apdu));
+}
 
-  char * token = strtok(buffer, delimiter);
-  int main = atoi(token);
-  token = strtok(NULL, delimiter);
-  int mid = atoi(token);
-  token = strtok(NULL, delimiter);
-  int sub = atoi(token);
+void knxGroupRead(uint16_t address)
+{
+  if (g_knxBcuDown)
+    return;
 
-  return KNX_GA(main, mid, sub);
+  // A_GroupValue_Read
+  uint8_t apdu[2] = { 0x00, 0x00 };
+  knxSendApdu(address, apdu, sizeof(apdu));
 }
 
-uint8_t getIndex(JsonVariant json)
+uint8_t knxUnwrapSecure(KnxTelegram * telegram, uint8_t secureKey, uint8_t * apdu)
 {
-  if (!json.containsKey("index"))
-  {
-    oxrs.println(F("[knx] missing index"));
+  // Secure telegrams are sent using the escape APCI (A_SecureService)
+  if (telegram->getCommand() != KNX_COMMAND_ESCAPE)
     return 0;
-  }
-  
-  uint8_t index = json["index"].as<uint8_t>();
 
-  // Check the index is valid for this device
-  if (index <= 0 || index > getMaxIndex())
-  {
-    oxrs.println(F("[knx] invalid index"));
+  uint8_t secureLength = telegram->getPayloadLength();
+  if (secureLength > KNX_FRAME_MAX_PAYLOAD)
     return 0;
+
+  uint8_t secureApdu[KNX_FRAME_MAX_PAYLOAD];
+  for (uint8_t i = 0; i < secureLength; i++)
+  {
+    secureApdu[i] = telegram->getBufferByte(KNX_FRAME_HEADER_SIZE + i);
   }
 
-  return index;
+  uint16_t sourceAddress = (telegram->getBufferByte(1) << 8) | telegram->getBufferByte(2);
+  uint16_t targetAddress = telegram->getTargetGroupAddress();
+
+  return knxSecure.decrypt(secureKey, sourceAddress, targetAddress, secureApdu, secureLength, apdu);
 }
 
-void jsonInputConfig(JsonVariant json)
+bool knxTelegramCheck(KnxTelegram * telegram)
 {
-  uint8_t index = getIndex(json);
-  if (index == 0) return;
+  // Receiving anything at all means the BCU is alive
+  knxBcuConfirm(true);
 
-  // Work out the MCP and pin we are configuring
-  int mcp = (index - 1) / MCP_PIN_COUNT;
-  int pin = (index - 1) % MCP_PIN_COUNT;
+  // Track bus activity so background reads can wait for a quiet period
+  g_knxBusActivityMs = millis();
 
-  if (json.containsKey("type"))
-  {
-    uint8_t inputType = parseInputType(json["type"]);    
+  // Check this is a message sent to a target group 
+  if (!telegram->isTargetGroup())
+    return false;
 
-    if (inputType != INVALID_INPUT_TYPE)
+  // Get the telegram address to save looking up for each loop iteration
+  uint16_t targetAddress = telegram->getTargetGroupAddress();
+
+  // Ensure we show interest where required, so an ACK can be sent 
+  for (uint8_t i = 0; i < MAX_INPUT_COUNT; i++)
+  {
+    if (g_knxConfig[i].stateAddress == targetAddress)
     {
-      setInputType(mcp, pin, inputType);
-      g_hassDiscoveryPublished[index - 1] = false;
+      return true;
     }
   }
-  
-  if (json.containsKey("invert"))
+
+  return false;
+}
+
+bool knxTelegramDuplicate(KnxTelegram * telegram)
+{
+  uint16_t source = (telegram->getBufferByte(1) << 8) | telegram->getBufferByte(2);
+  uint16_t target = (telegram->getBufferByte(3) << 8) | telegram->getBufferByte(4);
+
+  // FNV-1a over length and APCI/payload, leaving out the control field
+  // (repeat flag) and hop count which differ between copies
+  uint8_t length = telegram->getBufferByte(5) & 0x0F;
+  uint32_t hash = (2166136261UL ^ length) * 16777619UL;
+
+  for (uint8_t i = KNX_FRAME_HEADER_SIZE; i <= KNX_FRAME_HEADER_SIZE + length; i++)
   {
-    setInputInvert(mcp, pin, json["invert"].as<bool>());
-    g_hassDiscoveryPublished[index - 1] = false;
+    hash = (hash ^ telegram->getBufferByte(i)) * 16777619UL;
   }
 
-  if (json.containsKey("disabled"))
+  // Only a copy of the last telegram from this source to this target is a
+  // duplicate, so on -> off -> on in quick succession is not suppressed
+  for (uint8_t i = 0; i < KNX_DEDUP_SIZE; i++)
   {
-    setInputDisabled(mcp, pin, json["disabled"].as<bool>());
-    g_hassDiscoveryPublished[index - 1] = false;
+    if (g_knxSeen[i].ms == 0 || g_knxSeen[i].source != source || g_knxSeen[i].target != target)
+      continue;
+
+    if (g_knxSeen[i].hash == hash && (millis() - g_knxSeen[i].ms) < KNX_DEDUP_WINDOW_MS)
+      return true;
+
+    g_knxSeen[i].hash = hash;
+    g_knxSeen[i].ms = millis() | 1;
+    return false;
   }
 
-  if (json.containsKey("knxCommandAddress"))
+  g_knxSeen[g_knxSeenIdx].source = source;
+  g_knxSeen[g_knxSeenIdx].target = target;
+  g_knxSeen[g_knxSeenIdx].hash = hash;
+  g_knxSeen[g_knxSeenIdx].ms = millis() | 1;
+  g_knxSeenIdx = (g_knxSeenIdx + 1) % KNX_DEDUP_SIZE;
+
+  return false;
+}
+
+void knxTelegram(KnxTelegram * telegram, bool interesting)
+{
+  // Ignore any telegrams we didn't identify as being interesting
+  if (!interesting)
+    return;
+
+  // Ignore our own telegrams (e.g. a read we answered from our cached state
+  // must not refresh that state, or clear anything waiting on the actuator)
+  uint16_t sourceAddress = (telegram->getBufferByte(1) << 8) | telegram->getBufferByte(2);
+  if (sourceAddress == g_knxDeviceAddress)
+    return;
+
+  // Only process the first copy of any repeated/duplicated telegram
+  if (knxTelegramDuplicate(telegram))
   {
-    g_knxConfig[index - 1].commandAddress = parseGroupAddress(json["knxCommandAddress"]);
+    g_knxDuplicates++;
+    return;
   }
 
-  if (json.containsKey("knxStateAddress"))
+  // Get the telegram address to save looking up for each loop iteration
+  uint16_t targetAddress = telegram->getTargetGroupAddress();
+
+  KnxCommandType command;
+  uint8_t payloadLength;
+  bool value;
+
+  // Secure group addresses only accept (valid) secure telegrams
+  uint8_t secureKey = getKnxSecureKey(targetAddress);
+  if (secureKey == 0)
   {
-    g_knxConfig[index - 1].stateAddress = parseGroupAddress(json["knxStateAddress"]);
-    pushQueue(g_knxConfig[index - 1].stateAddress);
+    command = telegram->getCommand();
+    payloadLength = telegram->getPayloadLength();
+    value = telegram->getBool();
   }
-
-  if (json.containsKey("knxFailoverOnly"))
+  else
   {
-    g_knxConfig[index - 1].failoverOnly = json["knxFailoverOnly"].as<bool>();
+    uint8_t apdu[KNX_SECURE_APDU_MAX];
+    payloadLength = knxUnwrapSecure(telegram, secureKey, apdu);
+    if (payloadLength == 0)
+      return;
+
+    command = (KnxCommandType)(((apdu[0] & 0x03) << 2) | (apdu[1] >> 6));
+    value = apdu[1] & 0x01;
   }
-}
 
-void jsonConfig(JsonVariant json)
-{
-  if (json.containsKey("knxDeviceAddress"))
+  // Another device is reading one of our state addresses, so drop our own
+  // pending read for it and take the answer when it comes
+  if (command == KNX_COMMAND_READ)
   {
-    knx.setIndividualAddress(parseDeviceAddress(json["knxDeviceAddress"]));
+    if (removeQueue(targetAddress))
+    {
+      g_knxReadsSaved++;
+
+      for (uint8_t i = 0; i < MAX_INPUT_COUNT; i++)
+      {
+        if (g_knxConfig[i].stateAddress == targetAddress)
+        {
+          g_knxConfig[i].readOverheardMs = millis() | 1;
+        }
+      }
+    }
+
+    // Give the actuator a chance to answer before we answer for it
+    for (uint8_t i = 0; i < MAX_INPUT_COUNT; i++)
+    {
+      if (g_knxConfig[i].stateAddress == targetAddress && g_knxConfig[i].readProxyMs != 0 && g_knxConfig[i].readProxyPendingMs == 0)
+      {
+        g_knxConfig[i].readProxyPendingMs = millis() | 1;
+      }
+    }
+    return;
   }
 
-  if (json.containsKey("defaultInputType"))
-  {
-    uint8_t inputType = parseInputType(json["defaultInputType"]);
+  // Only interested in write/response telegrams - i.e. a device publishing state 
+  if (command != KNX_COMMAND_WRITE && command != KNX_COMMAND_ANSWER)
+    return;
 
-    if (inputType != INVALID_INPUT_TYPE)
+  // Only interested in 1-bit (bool) values
+  if (payloadLength != 2)
+    return;
+
+  // Update our internal state for any inputs with this stateAddress
+  for (uint8_t i = 0; i < MAX_INPUT_COUNT; i++)
+  {
+    if (g_knxConfig[i].stateAddress == targetAddress)
     {
-      setDefaultInputType(inputType);
+      bool changed = g_knxConfig[i].state != value || g_knxConfig[i].lastStateUpdateMs == 0;
+
+      g_knxConfig[i].state = value;
+      g_knxConfig[i].lastStateUpdateMs = millis();
+      g_knxConfig[i].readOverheardMs = 0;
+
+      // The actuator answered in time, or after we answered for it
+      g_knxConfig[i].readProxyPendingMs = 0;
+      if (g_knxConfig[i].readProxyAnsweredMs != 0 && command == KNX_COMMAND_ANSWER)
+      {
+        g_knxReadProxySavedMs += millis() - g_knxConfig[i].readProxyAnsweredMs;
+        g_knxConfig[i].readProxyAnsweredMs = 0;
+      }
+
+      // Keep any Home Assistant entity for this actuator up to date
+      #if !defined(NO_HASS)
+      if (changed && g_knxConfig[i].hassEntity != HASS_ENTITY_NONE)
+      {
+        publishKnxState(i + 1);
+      }
+      #else
+      (void)changed;
+      #endif
+
+      // The actuator has confirmed the command we sent
+      if (g_knxConfig[i].verifyPhase != KNX_VERIFY_IDLE && g_knxConfig[i].verifyState == value)
+      {
+        g_knxConfig[i].verifyPhase = KNX_VERIFY_IDLE;
+        g_knxVerifyPending--;
+      }
     }
   }
 
-  if (json.containsKey("inputs"))
+  // No need to send our own read for this address anymore
+  if (removeQueue(targetAddress))
   {
-    // Flush the KNX read queue before loading any input configuration
-    flushQueue();
+    g_knxReadsSaved++;
+  }
+
+  // If this was the address we were waiting on, then clear so we can move onto
+  // the next item in the queue
+  if (g_knxReadWaitAddress == targetAddress)
+  {
+    g_knxReadWaitAddress = 0;
+    g_knxReadWaitSince = 0;
+  }
+}
+
+bool pushTxQueue(uint16_t address, uint8_t type, uint8_t value)
+{
+  if (address == 0)
+    return false;
+
+  // Nothing is sent while the BCU is down, so don't queue anything to go
+  // out (stale) once it recovers
+  if (g_knxBcuDown)
+    return false;
+
+  // Check there is room, the queue is full if the head would hit the tail
+  uint8_t headIdx = (g_knxTxQueueHeadIdx + 1) % KNX_TX_QUEUE_SIZE;
+  if (headIdx == g_knxTxQueueTailIdx)
+  {
+    g_knxTxQueueDropped++;
+    logEvent(LOG_TX_QUEUE_FULL, address);
+    return false;
+  }
+
+  // Insert at the head of the queue
+  g_knxTxQueue[g_knxTxQueueHeadIdx].address = address;
+  g_knxTxQueue[g_knxTxQueueHeadIdx].type = type;
+  g_knxTxQueue[g_knxTxQueueHeadIdx].value = value;
+  g_knxTxQueueHeadIdx = headIdx;
+
+  return true;
+}
+
+bool popTxQueue(KnxTxItem * item)
+{
+  if (g_knxTxQueueHeadIdx == g_knxTxQueueTailIdx)
+    return false;
+
+  // Retrieve from the tail of the queue
+  *item = g_knxTxQueue[g_knxTxQueueTailIdx];
+  g_knxTxQueueTailIdx = (g_knxTxQueueTailIdx + 1) % KNX_TX_QUEUE_SIZE;
+
+  return true;
+}
+
+uint8_t getTxQueueFree()
+{
+  // One slot is always left empty to tell a full queue from an empty one
+  return KNX_TX_QUEUE_SIZE - 1 - ((g_knxTxQueueHeadIdx + KNX_TX_QUEUE_SIZE - g_knxTxQueueTailIdx) % KNX_TX_QUEUE_SIZE);
+}
+
+bool isKnxTxIdle()
+{
+  // Nothing waiting to be built, streamed or confirmed
+  return g_knxTxQueueHeadIdx == g_knxTxQueueTailIdx && g_knxTxFrameHeadIdx == g_knxTxFrameTailIdx && g_knxTxInFlight == 0;
+}
+
+void loopKnxTx()
+{
+  // Only build as many frames as the BCU pipeline can take, the rest wait
+  // here so live telegrams don't get stuck behind a long burst
+  KnxTxItem item;
+  while (((g_knxTxFrameHeadIdx + KNX_TX_FRAME_QUEUE_SIZE - g_knxTxFrameTailIdx) % KNX_TX_FRAME_QUEUE_SIZE) < KNX_TX_PIPELINE_DEPTH)
+  {
+    if (!popTxQueue(&item))
+      return;
+
+    switch (item.type)
+    {
+      case KNX_TX_WRITE_BOOL:
+        knxGroupWriteBool(item.address, item.value);
+        break;
+      case KNX_TX_WRITE_DIM:
+        knxGroupWrite4BitDim(item.address, bitRead(item.value, 3), item.value & 0x07);
+        break;
+      case KNX_TX_READ:
+        knxGroupRead(item.address);
+        break;
+      case KNX_TX_ANSWER_BOOL:
+        knxGroupAnswerBool(item.address, item.value);
+        break;
+    }
+  }
+}
+
+void publishKnxVerifyFailed(uint8_t index)
+{
+  // Calculate the port and channel for this index (all 1-based)
+  uint8_t port = ((index - 1) / 4) + 1;
+  uint8_t channel = index - ((port - 1) * 4);
+
+  JsonDocument json;
+  json["port"] = port;
+  json["channel"] = channel;
+  json["index"] = index;
+  json["knx"] = "verifyFailed";
+
+  oxrs.publishStatus(json.as<JsonVariant>());
+}
+
+void loopKnxVerify()
+{
+  if (g_knxVerifyPending == 0)
+    return;
+
+  for (uint8_t i = 0; i < MAX_INPUT_COUNT; i++)
+  {
+    KnxConfig * config = &g_knxConfig[i];
+
+    if (config->verifyPhase == KNX_VERIFY_IDLE)
+      continue;
+
+    if ((millis() - config->verifySince) < config->verifyMs)
+      continue;
+
+    if (config->verifyPhase == KNX_VERIFY_WAITING)
+    {
+      // No status telegram, maybe we missed it so ask the actuator directly
+      pushTxQueue(config->stateAddress, KNX_TX_READ, 0);
+      config->verifyPhase = KNX_VERIFY_READING;
+    }
+    else if (config->verifyRetries < KNX_VERIFY_MAX_RETRIES)
+    {
+      // Still not in the expected state, re-send the command
+      pushTxQueue(config->commandAddress, KNX_TX_WRITE_BOOL, config->verifyState);
+      config->verifyPhase = KNX_VERIFY_WAITING;
+      config->verifyRetries++;
+      g_knxVerifyRetries++;
+    }
+    else
+    {
+      // Give up and let someone know
+      config->verifyPhase = KNX_VERIFY_IDLE;
+      g_knxVerifyPending--;
+      g_knxVerifyFailures++;
+
+      logEvent(LOG_VERIFY_FAILED, i + 1);
+      publishKnxVerifyFailed(i + 1);
+    }
+
+    config->verifySince = millis();
+  }
+}
+
+void initialiseKnx()
+{
+  // Listen for telegrams addressed to our KNX state addresses 
+  knx.setTelegramCheckCallback(knxTelegramCheck);
+  knx.setKnxTelegramCallback(knxTelegram);
+
+  // Configure the second serial port on the ESP32 for the KNX BCU
+  logger.println(F("[knx] setting up Serial2 for KNX BCU..."));
+  logger.print(F(" - baud:   "));
+  logger.println(KNX_SERIAL_BAUD);
+  logger.print(F(" - config: "));
+  logger.println(KNX_SERIAL_CONFIG);
+  logger.print(F(" - rx pin: "));
+  logger.println(KNX_SERIAL_RX);
+  logger.print(F(" - tx pin: "));
+  logger.println(KNX_SERIAL_TX);
+
+  Serial2.begin(KNX_SERIAL_BAUD, KNX_SERIAL_CONFIG, KNX_SERIAL_RX, KNX_SERIAL_TX);
+
+  // Restore KNX Data Secure sequence counters
+  knxSecure.begin();
+
+  // Reset the UART connection on startup
+  if (knx.uartReset(KNX_RESET_TIMEOUT_MS))
+  {
+    logger.println(F("[knx] UART reset OK"));
+  }
+  else
+  {
+    logger.print(F("[knx] UART reset timed out after "));
+    logger.print(KNX_RESET_TIMEOUT_MS);
+    logger.println(F("ms"));
+
+    // Let the watchdog keep trying
+    knxBcuDown();
+  }
+}
+
+void loopKnxBcu()
+{
+  if (!g_knxBcuDown)
+    return;
+
+  // Park any outstanding read so it is retried once the BCU is back
+  if (g_knxReadWaitAddress != 0)
+  {
+    pushQueue(g_knxReadWaitAddress);
+
+    g_knxReadWaitAddress = 0;
+    g_knxReadWaitSince = 0;
+  }
+
+  // Retry the UART reset with exponential backoff
+  if ((millis() - g_knxBcuRetryMs) < g_knxBcuBackoffMs)
+    return;
+
+  g_knxBcuResets++;
+  if (knx.uartReset(KNX_BCU_PROBE_MS))
+  {
+    knxBcuUp();
+    return;
+  }
+
+  g_knxBcuRetryMs = millis();
+  g_knxBcuBackoffMs = min(g_knxBcuBackoffMs * 2, (uint32_t)KNX_BCU_BACKOFF_MAX_MS);
+}
+
+void loopKnxReadProxy()
+{
+  for (uint8_t i = 0; i < MAX_INPUT_COUNT; i++)
+  {
+    KnxConfig * config = &g_knxConfig[i];
+
+    // Stop waiting for the actuator's own answer to a read we answered
+    if (config->readProxyAnsweredMs != 0 && (millis() - config->readProxyAnsweredMs) > KNX_READ_TIMEOUT_MS)
+    {
+      config->readProxyAnsweredMs = 0;
+    }
+
+    if (config->readProxyPendingMs == 0)
+      continue;
+
+    if ((millis() - config->readProxyPendingMs) < config->readProxyMs)
+      continue;
+
+    config->readProxyPendingMs = 0;
+
+    // Only answer with a value we know is fresh
+    if (config->lastStateUpdateMs == 0 || (millis() - config->lastStateUpdateMs) > g_knxReadProxyMaxAgeMs)
+      continue;
+
+    if (!pushTxQueue(config->stateAddress, KNX_TX_ANSWER_BOOL, config->state))
+      continue;
+
+    g_knxReadsProxied++;
+
+    // We have answered for any other inputs sharing this address too
+    for (uint8_t j = 0; j < MAX_INPUT_COUNT; j++)
+    {
+      if (g_knxConfig[j].stateAddress == config->stateAddress)
+      {
+        g_knxConfig[j].readProxyPendingMs = 0;
+        g_knxConfig[j].readProxyAnsweredMs = millis() | 1;
+      }
+    }
+  }
+}
+
+void loopKnx()
+{
+  // Check for any events on the KNX bus, and transmit confirmations
+  knxReceive();
+  knxTxCheckTimeout();
+
+  // Keep trying to recover the BCU if it has stopped responding
+  loopKnxBcu();
+
+  // Don't send any reads (and pile up timeouts) while the BCU is down
+  if (g_knxBcuDown)
+    return;
+
+  // Send any queued telegrams, and keep the BCU fed
+  loopKnxTx();
+  knxStreamFrames();
+
+  // Check any commands we are waiting on actuators to confirm
+  loopKnxVerify();
+
+  // Answer any reads slow actuators haven't
+  loopKnxReadProxy();
+
+  // Are we waiting on a read response?
+  if (g_knxReadWaitAddress == 0)
+  {
+    // If we are not waiting then check the queue
+    if (!isQueueEmpty())
+    {
+      // Background reads wait for a gap in bus traffic, unless they have been
+      // held back for too long
+      if (!isKnxBusIdle())
+      {
+        if (g_knxReadHeldSince == 0)
+        {
+          g_knxReadHeldSince = millis() | 1;
+          g_knxReadsDeferred++;
+        }
+
+        if ((millis() - g_knxReadHeldSince) < KNX_READ_STARVATION_MS)
+          return;
+      }
+
+      g_knxReadHeldSince = 0;
+
+      // Something was on the queue so send a read request
+      uint16_t address = popQueue();
+      knxGroupRead(address);
+
+      // Start the timeout timer
+      g_knxReadWaitAddress = address;
+      g_knxReadWaitSince = millis();
+    }
+    else
+    {
+      // Queue is empty so check if there are any addresses that have expired state
+      for (uint8_t i = 0; i < MAX_INPUT_COUNT; i++)
+      {
+        if ((millis() - g_knxConfig[i].lastStateUpdateMs) > KNX_STATE_EXPIRY_MS)
+        {
+          pushQueue(g_knxConfig[i].stateAddress);
+        }
+
+        // If nobody answered a read we dropped in favour of another device's
+        // read then queue our own again
+        if (g_knxConfig[i].readOverheardMs != 0 && (millis() - g_knxConfig[i].readOverheardMs) > KNX_READ_TIMEOUT_MS)
+        {
+          g_knxConfig[i].readOverheardMs = 0;
+          pushQueue(g_knxConfig[i].stateAddress);
+        }
+      }
+    }
+  }
+  else
+  {
+    // If we have timed out waiting for a response then re-queue and continue
+    if ((millis() - g_knxReadWaitSince) > KNX_READ_TIMEOUT_MS)
+    {
+      // Push this address back onto the queue
+      pushQueue(g_knxReadWaitAddress);
+      
+      // Clear the timeout timer
+      g_knxReadWaitAddress = 0;
+      g_knxReadWaitSince = 0;
+
+      // Repeated timeouts could mean the BCU (or bus) has gone away
+      knxBcuConfirm(false);
+    }
+  }
+}
+
+void knxGroupWriteVerified(uint8_t index, bool value)
+{
+  KnxConfig * config = &g_knxConfig[index - 1];
+
+  pushTxQueue(config->commandAddress, KNX_TX_WRITE_BOOL, value);
+
+  // Can only verify if we know where the actuator publishes its state
+  if (config->verifyMs == 0 || config->stateAddress == 0)
+    return;
+
+  // Start (or restart) the verification window
+  if (config->verifyPhase == KNX_VERIFY_IDLE)
+  {
+    g_knxVerifyPending++;
+  }
+
+  config->verifyPhase = KNX_VERIFY_WAITING;
+  config->verifyRetries = 0;
+  config->verifyState = value;
+  config->verifySince = millis();
+}
+
+void publishKnxEvent(uint8_t index, uint8_t type, uint8_t state)
+{
+  // Get the KNX group address configured for this input (if any)...
+  uint16_t commandAddress = g_knxConfig[index - 1].commandAddress;
+  
+  // Ignore if no KNX command address configured  
+  if (commandAddress == 0)
+    return;
+
+  // Determine what type of KNX telegram to send...
+  switch (type)
+  {
+    case BUTTON:
+      // Only handle single-press events, treat as TOGGLE
+      if (state == 1)
+      {
+        knxGroupWriteVerified(index, !g_knxConfig[index - 1].state);
+      }
+      break;
+    case ROTARY:
+      // Send relative inc/dec dimming telegram (no internal state needed)
+      pushTxQueue(commandAddress, KNX_TX_WRITE_DIM, (state == LOW_EVENT ? 0x08 : 0x00) | 5);
+      break;
+    case CONTACT:
+    case SECURITY:
+    case SWITCH:
+      // Send boolean telegram (no internal state needed)
+      // CONTACT:   LOW_EVENT => open
+      // SECURITY:  LOW_EVENT => alarm  <-- what about TAMPER, FAULT, SHORT?
+      // SWITCH:    LOW_EVENT => on
+      knxGroupWriteVerified(index, state == LOW_EVENT);
+      break;
+    case PRESS:
+    case TOGGLE:
+      // Send boolean telegram with toggled state
+      knxGroupWriteVerified(index, !g_knxConfig[index - 1].state);
+      break;  
+  }
+}
+
+void createKnxValueEnum(JsonObject parent)
+{
+  JsonArray valueEnum = parent["enum"].to<JsonArray>();
+  
+  valueEnum.add("on");
+  valueEnum.add("off");
+  valueEnum.add("up");
+  valueEnum.add("down");
+}
+
+/**
+  MQTT benchmark
+ */
+#if defined(MQTT_BENCHMARK)
+char * getBenchmarkTopic(char topic[])
+{
+  // Never on an event topic, so nothing watching inputs sees the load
+  oxrs.getMQTT()->getStatusTopic(topic);
+  strcat(topic, "/benchmark");
+
+  return topic;
+}
+
+void startBenchmark(uint16_t rate, uint32_t durationMs)
+{
+  if (rate == 0 || durationMs == 0)
+    return;
+
+  mqttBenchmark.start(rate, durationMs, millis());
+
+  // Start a fresh latency histogram for the benchmark
+  mqttStats.resetPeriod();
+
+  logger.println(F("[knx] starting MQTT benchmark..."));
+}
+
+bool publishBenchmark(uint32_t sequence)
+{
+  JsonDocument json;
+  json["type"] = "benchmark";
+  json["sequence"] = sequence;
+
+  char topic[64];
+  uint32_t startUs = micros();
+  bool success = oxrs.getMQTT()->publish(json.as<JsonVariant>(), getBenchmarkTopic(topic), false);
+  mqttStats.record(success, micros() - startUs);
+
+  return success;
+}
+
+void loopBenchmark()
+{
+  if (!mqttBenchmark.loop(millis(), publishBenchmark))
+    return;
+
+  // Report the results along with the latency histogram
+  JsonDocument json;
+  JsonObject benchmarkJson = json["benchmark"].to<JsonObject>();
+  benchmarkJson["rate"] = mqttBenchmark.getRate();
+  benchmarkJson["durationMs"] = mqttBenchmark.getElapsedMs();
+  benchmarkJson["sent"] = mqttBenchmark.getSent();
+  benchmarkJson["failed"] = mqttBenchmark.getFailed();
+  benchmarkJson["sustainedRate"] = mqttBenchmark.getSustainedRate();
+  oxrs.publishTelemetry(json.as<JsonVariant>());
+
+  publishTelemetry();
+}
+#endif
+
+/**
+  Waveform capture
+*/
+#if !defined(NO_REST)
+void startCapture(uint8_t index)
+{
+  // Index 0 cancels any armed capture
+  g_captureState = index == 0 ? CAPTURE_IDLE : CAPTURE_ARMED;
+  g_captureIndex = index;
+  g_captureCount = 0;
+}
+
+void publishCapture()
+{
+  // Calculate the port and channel for this index (all 1-based)
+  uint8_t port = ((g_captureIndex - 1) / 4) + 1;
+  uint8_t channel = g_captureIndex - ((port - 1) * 4);
+
+  JsonDocument json;
+  json["port"] = port;
+  json["channel"] = channel;
+  json["index"] = g_captureIndex;
+  json["capture"] = "complete";
+  json["samples"] = g_captureCount;
+  json["durationUs"] = g_captureUs[g_captureCount - 1];
+
+  oxrs.publishStatus(json.as<JsonVariant>());
+}
+
+void checkCapture(uint8_t mcp, uint16_t io_value)
+{
+  if (g_captureState != CAPTURE_ARMED)
+    return;
+
+  if ((g_captureIndex - 1) / MCP_PIN_COUNT != mcp)
+    return;
+
+  uint8_t pin = (g_captureIndex - 1) % MCP_PIN_COUNT;
+
+  // Keep the last sample before the edge as the first sample
+  if (g_captureCount == 0 || bitRead(io_value, pin) == bitRead(g_captureWord[0], pin))
+  {
+    g_captureWord[0] = io_value;
+    g_captureUs[0] = micros();
+    g_captureCount = 1;
+    return;
+  }
+
+  // Edge seen, sample the MCP as fast as we can until the buffer is full
+  uint32_t triggerUs = g_captureUs[0];
+  g_captureUs[0] = 0;
+  g_captureWord[1] = io_value;
+  g_captureUs[1] = micros() - triggerUs;
+
+  // Give up the bus between samples so the rotary task keeps its rate
+  for (g_captureCount = 2; g_captureCount < CAPTURE_SAMPLES; g_captureCount++)
+  {
+    xSemaphoreTake(g_mcpMutex, portMAX_DELAY);
+    g_captureWord[g_captureCount] = mcp23017[mcp].readGPIOAB();
+    xSemaphoreGive(g_mcpMutex);
+    g_captureUs[g_captureCount] = micros() - triggerUs;
+  }
+
+  g_captureState = CAPTURE_DONE;
+  publishCapture();
+}
+
+void apiCapture(Request &req, Response &res)
+{
+  if (g_captureState != CAPTURE_DONE)
+  {
+    res.sendStatus(404);
+    return;
+  }
+
+  // Plain CSV, one raw MCP sample word per line
+  res.set("Content-Type", "text/csv");
+  res.print(F("# index "));
+  res.print(g_captureIndex);
+  res.print(F(" pin "));
+  res.println((g_captureIndex - 1) % MCP_PIN_COUNT);
+  res.println(F("us,word"));
+
+  for (uint16_t i = 0; i < g_captureCount; i++)
+  {
+    res.print(g_captureUs[i]);
+    res.print(',');
+    res.println(g_captureWord[i], HEX);
+  }
+}
+#endif
+
+/**
+  Config handler
+ */
+void setConfigSchema()
+{
+  // Define our config schema
+  JsonDocument json;
+
+  JsonObject knxDeviceAddress = json["knxDeviceAddress"].to<JsonObject>();
+  knxDeviceAddress["title"] = "KNX Device Address";
+  knxDeviceAddress["description"] = "The physical address of this device on the KNX bus. Defaults to 1.1.244.";
+  knxDeviceAddress["type"] = "string";
+  knxDeviceAddress["pattern"] = "^\\d+\\.\\d+\\.\\d+$";
+
+  JsonObject defaultInputType = json["defaultInputType"].to<JsonObject>();
+  defaultInputType["title"] = "Default Input Type";
+  defaultInputType["description"] = "Set the default input type for anything without explicit configuration below. Defaults to ‘switch’.";
+  createInputTypeEnum(defaultInputType);
+
+  JsonObject eventTopicLayout = json["eventTopicLayout"].to<JsonObject>();
+  eventTopicLayout["title"] = "Event Topic Layout";
+  eventTopicLayout["description"] = "Publish input events to the status topic (default), or to per-type (e.g. …/security) or per-event (e.g. …/security/alarm) subtopics so subscribers only receive what they need. The per-event layout is not supported by Home Assistant discovery.";
+  createEventTopicLayoutEnum(eventTopicLayout);
+
+  JsonObject knxPowerOnBroadcast = json["knxPowerOnBroadcast"].to<JsonObject>();
+  knxPowerOnBroadcast["title"] = "KNX Power-On Broadcast";
+  knxPowerOnBroadcast["description"] = "After a reboot, send the current state of all contact, switch and security inputs to their KNX command addresses (security inputs first, paced to avoid flooding the bus). Failover-only inputs are skipped. Defaults to false.";
+  knxPowerOnBroadcast["type"] = "boolean";
+
+  JsonObject knxReadProxyMaxAgeMs = json["knxReadProxyMaxAgeMs"].to<JsonObject>();
+  knxReadProxyMaxAgeMs["title"] = "KNX Read Proxy Max Age (ms)";
+  knxReadProxyMaxAgeMs["description"] = "Reads are only answered on behalf of an actuator if its state was updated within this time. Defaults to 60000 (1 minute).";
+  knxReadProxyMaxAgeMs["type"] = "integer";
+  knxReadProxyMaxAgeMs["minimum"] = 0;
+  knxReadProxyMaxAgeMs["maximum"] = KNX_STATE_EXPIRY_MS;
+
+  JsonObject inputs = json["inputs"].to<JsonObject>();
+  inputs["title"] = "Input Configuration";
+  inputs["description"] = "Add configuration for each input in use on your device. The 1-based index specifies which input you wish to configure. The type defines how an input is monitored and what events are emitted. The KNX group addresses must be in standard 3-level format, e.g. 1/2/3.";
+  inputs["type"] = "array";
+  
+  JsonObject items = inputs["items"].to<JsonObject>();
+  items["type"] = "object";
+
+  JsonObject properties = items["properties"].to<JsonObject>();
+
+  JsonObject index = properties["index"].to<JsonObject>();
+  index["title"] = "Index";
+  index["type"] = "integer";
+  index["minimum"] = 1;
+  index["maximum"] = getMaxIndex();
+
+  JsonObject type = properties["type"].to<JsonObject>();
+  type["title"] = "Type";
+  createInputTypeEnum(type);
+
+  JsonObject invert = properties["invert"].to<JsonObject>();
+  invert["title"] = "Invert";
+  invert["type"] = "boolean";
+
+  JsonObject disabled = properties["disabled"].to<JsonObject>();
+  disabled["title"] = "Disabled";
+  disabled["type"] = "boolean";
+
+  JsonObject debounceMs = properties["debounceMs"].to<JsonObject>();
+  debounceMs["title"] = "Debounce (ms)";
+  debounceMs["description"] = "How long the input must be stable before a change is reported. Lower for clean electronic contacts, raise for noisy mechanical ones. Set to 0 for the default.";
+  debounceMs["type"] = "integer";
+  debounceMs["minimum"] = 0;
+  debounceMs["maximum"] = UINT8_MAX;
+
+  JsonObject holdMs = properties["holdMs"].to<JsonObject>();
+  holdMs["title"] = "Hold Time (ms)";
+  holdMs["description"] = "How long a button must be pressed to report a hold event (100ms resolution). Set to 0 for the default.";
+  holdMs["type"] = "integer";
+  holdMs["minimum"] = 0;
+  holdMs["maximum"] = UINT8_MAX * INPUT_HOLD_UNIT_MS;
+
+  JsonObject multiClickMs = properties["multiClickMs"].to<JsonObject>();
+  multiClickMs["title"] = "Multi-Click Window (ms)";
+  multiClickMs["description"] = "How long to wait for another click before reporting a button's click count (10ms resolution). Set to 0 for the default.";
+  multiClickMs["type"] = "integer";
+  multiClickMs["minimum"] = 0;
+  multiClickMs["maximum"] = UINT8_MAX * INPUT_CLICK_UNIT_MS;
+
+  JsonObject knxCommandAddress = properties["knxCommandAddress"].to<JsonObject>();
+  knxCommandAddress["title"] = "KNX Command Address";
+  knxCommandAddress["type"] = "string";
+  knxCommandAddress["pattern"] = "^\\d+\\/\\d+\\/\\d+$";
+
+  JsonObject knxStateAddress = properties["knxStateAddress"].to<JsonObject>();
+  knxStateAddress["title"] = "KNX State Address";
+  knxStateAddress["type"] = "string";
+  knxStateAddress["pattern"] = "^\\d+\\/\\d+\\/\\d+$";
+
+  JsonObject knxFailoverOnly = properties["knxFailoverOnly"].to<JsonObject>();
+  knxFailoverOnly["title"] = "KNX Failover Only";
+  knxFailoverOnly["type"] = "boolean";
+
+  #if !defined(NO_HASS)
+  JsonObject knxEntity = properties["knxEntity"].to<JsonObject>();
+  knxEntity["title"] = "KNX Home Assistant Entity";
+  knxEntity["description"] = "Expose the KNX actuator as a Home Assistant switch or light. State comes from the KNX state address, commands are sent to the KNX command address. Defaults to ‘none’.";
+  createHassEntityEnum(knxEntity);
+  #endif
+
+  JsonObject knxVerifyMs = properties["knxVerifyMs"].to<JsonObject>();
+  knxVerifyMs["title"] = "KNX Verify Timeout (ms)";
+  knxVerifyMs["description"] = "How long to wait for the actuator to confirm a command on the state address, before reading the state and re-sending the command. Set to 0 to disable (default).";
+  knxVerifyMs["type"] = "integer";
+  knxVerifyMs["minimum"] = 0;
+  knxVerifyMs["maximum"] = KNX_VERIFY_MAX_MS;
+
+  JsonObject knxReadProxyMs = properties["knxReadProxyMs"].to<JsonObject>();
+  knxReadProxyMs["title"] = "KNX Read Proxy Delay (ms)";
+  knxReadProxyMs["description"] = "For slow actuators, answer reads of the state address from our cached state if the actuator hasn't answered within this time (and our state is fresh). Set to 0 to disable (default).";
+  knxReadProxyMs["type"] = "integer";
+  knxReadProxyMs["minimum"] = 0;
+  knxReadProxyMs["maximum"] = KNX_READ_PROXY_MAX_MS;
+
+  JsonObject knxSecureKey = properties["knxSecureKey"].to<JsonObject>();
+  knxSecureKey["title"] = "KNX Secure Key";
+  knxSecureKey["description"] = "KNX Data Secure group key (32 hex characters, from ETS) for the command and state addresses. Leave empty for plain telegrams.";
+  knxSecureKey["type"] = "string";
+  knxSecureKey["pattern"] = "^([0-9a-fA-F]{32})?$";
+
+  JsonArray required = items["required"].to<JsonArray>();
+  required.add("index");
+
+  // Add any Home Assistant config
+  #if !defined(NO_HASS)
+  hass.setConfigSchema(json);
+  #endif
+
+  // Pass our config schema down to the hardware library
+  oxrs.setConfigSchema(json.as<JsonVariant>());
+}
+
+bool parseAddressParts(const char * address, char delimiter, int parts[3])
+{
+  // Parse in place, no copies of the (payload sized) string
+  if (address == NULL)
+    return false;
+
+  const char * token = address;
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    char * end;
+    parts[i] = strtol(token, &end, 10);
+
+    // Must have digits, followed by a delimiter (or the end for the last part)
+    if (end == token)
+      return false;
+
+    if (*end != (i < 2 ? delimiter : 0))
+      return false;
+
+    token = end + 1;
+  }
+
+  return true;
+}
+
+uint16_t parseDeviceAddress(const char * address)
+{
+  int parts[3];
+  if (!parseAddressParts(address, '.', parts))
+  {
+    logEvent(LOG_INVALID_DEVICE_ADDRESS);
+    return 0;
+  }
+
+  return KNX_IA(parts[0], parts[1], parts[2]);
+}
+
+uint16_t parseGroupAddress(const char * address)
+{
+  // Empty means not configured
+  if (address == NULL || strlen(address) == 0)
+    return 0;
+
+  int parts[3];
+  if (!parseAddressParts(address, '/', parts))
+  {
+    logEvent(LOG_INVALID_GROUP_ADDRESS);
+    return 0;
+  }
+
+  return KNX_GA(parts[0], parts[1], parts[2]);
+}
+
+uint8_t parseSecureKey(const char * hex)
+{
+  // Empty (or null) key means plain telegrams
+  if (hex == NULL || strlen(hex) == 0)
+    return 0;
+
+  if (strlen(hex) != KNX_SECURE_KEY_LENGTH * 2)
+  {
+    logEvent(LOG_INVALID_SECURE_KEY);
+    return 0;
+  }
+
+  uint8_t key[KNX_SECURE_KEY_LENGTH];
+  for (uint8_t i = 0; i < KNX_SECURE_KEY_LENGTH; i++)
+  {
+    char buffer[3] = { hex[i * 2], hex[i * 2 + 1], 0 };
+    char * end;
+
+    key[i] = strtoul(buffer, &end, 16);
+    if (*end != 0)
+    {
+      logEvent(LOG_INVALID_SECURE_KEY);
+      return 0;
+    }
+  }
+
+  // Schedules the key (if not already scheduled) and returns its slot
+  uint8_t secureKey = knxSecure.addKey(key);
+  if (secureKey == 0)
+  {
+    logEvent(LOG_SECURE_KEYS_FULL);
+  }
+
+  return secureKey;
+}
+
+uint8_t getIndex(JsonVariant json)
+{
+  if (!json.containsKey("index"))
+  {
+    logEvent(LOG_MISSING_INDEX);
+    return 0;
+  }
+  
+  uint8_t index = json["index"].as<uint8_t>();
+
+  // Check the index is valid for this device
+  if (index <= 0 || index > getMaxIndex())
+  {
+    logEvent(LOG_INVALID_INDEX, index);
+    return 0;
+  }
+
+  return index;
+}
+
+void jsonInputConfig(JsonVariant json)
+{
+  uint8_t index = getIndex(json);
+  if (index == 0) return;
+
+  // Work out the MCP and pin we are configuring
+  int mcp = (index - 1) / MCP_PIN_COUNT;
+  int pin = (index - 1) % MCP_PIN_COUNT;
+
+  if (json.containsKey("type"))
+  {
+    uint8_t inputType = parseInputType(json["type"]);    
+
+    if (inputType != INVALID_INPUT_TYPE)
+    {
+      setInputType(mcp, pin, inputType);
+    }
+  }
+  
+  if (json.containsKey("invert"))
+  {
+    setInputInvert(mcp, pin, json["invert"].as<bool>());
+  }
+
+  if (json.containsKey("disabled"))
+  {
+    setInputDisabled(mcp, pin, json["disabled"].as<bool>());
+  }
+
+  setInputTiming(mcp, pin, json);
+
+  if (json.containsKey("knxCommandAddress"))
+  {
+    uint16_t commandAddress = parseGroupAddress(json["knxCommandAddress"]);
+
+    // Discovery only depends on the command address if there is an entity
+    #if !defined(NO_HASS)
+    if (commandAddress != g_knxConfig[index - 1].commandAddress && g_knxConfig[index - 1].hassEntity != HASS_ENTITY_NONE)
+    {
+      g_hassKnxDiscoveryPublished[index - 1] = false;
+    }
+    #endif
+
+    g_knxConfig[index - 1].commandAddress = commandAddress;
+  }
+
+  if (json.containsKey("knxStateAddress"))
+  {
+    g_knxConfig[index - 1].stateAddress = parseGroupAddress(json["knxStateAddress"]);
+    pushQueue(g_knxConfig[index - 1].stateAddress);
+  }
+
+  if (json.containsKey("knxFailoverOnly"))
+  {
+    g_knxConfig[index - 1].failoverOnly = json["knxFailoverOnly"].as<bool>();
+  }
+
+  #if !defined(NO_HASS)
+  if (json.containsKey("knxEntity"))
+  {
+    uint8_t hassEntity = parseHassEntity(json["knxEntity"]);
+
+    if (hassEntity != g_knxConfig[index - 1].hassEntity)
+    {
+      g_knxConfig[index - 1].hassEntity = hassEntity;
+      g_hassKnxDiscoveryPublished[index - 1] = false;
+    }
+  }
+
+  // Publish any changes to the Home Assistant entity for this actuator
+  if (!g_hassKnxDiscoveryPublished[index - 1])
+  {
+    g_hassDiscoveryPending = true;
+  }
+  #endif
+
+  if (json.containsKey("knxVerifyMs"))
+  {
+    g_knxConfig[index - 1].verifyMs = min(json["knxVerifyMs"].as<uint16_t>(), (uint16_t)KNX_VERIFY_MAX_MS);
+  }
+
+  if (json.containsKey("knxReadProxyMs"))
+  {
+    g_knxConfig[index - 1].readProxyMs = min(json["knxReadProxyMs"].as<uint16_t>(), (uint16_t)KNX_READ_PROXY_MAX_MS);
+    g_knxConfig[index - 1].readProxyPendingMs = 0;
+  }
+
+  if (json.containsKey("knxSecureKey"))
+  {
+    // Release any previous key so its slot can be re-used
+    knxSecure.removeKey(g_knxConfig[index - 1].secureKey);
+    g_knxConfig[index - 1].secureKey = parseSecureKey(json["knxSecureKey"]);
+  }
+}
+
+void jsonConfig(JsonVariant json)
+{
+  // Stage any input config changes so they can be applied in one pass
+  stageInputConfig();
+
+  if (json.containsKey("knxDeviceAddress"))
+  {
+    uint16_t address = parseDeviceAddress(json["knxDeviceAddress"]);
+    if (address != 0)
+    {
+      g_knxDeviceAddress = address;
+      knx.setIndividualAddress(g_knxDeviceAddress);
+    }
+  }
+
+  if (json.containsKey("defaultInputType"))
+  {
+    uint8_t inputType = parseInputType(json["defaultInputType"]);
+
+    if (inputType != INVALID_INPUT_TYPE)
+    {
+      setDefaultInputType(inputType);
+    }
+  }
+
+  if (json.containsKey("eventTopicLayout"))
+  {
+    uint8_t layout = parseEventTopicLayout(json["eventTopicLayout"]);
+
+    // Home Assistant discovery needs to be republished with the new topics
+    if (layout != g_eventTopicLayout)
+    {
+      g_eventTopicLayout = layout;
+      republishHassDiscovery();
+
+      #if !defined(NO_HASS)
+      if (layout == EVENT_TOPIC_EVENT)
+      {
+        logger.println(F("[knx] per-event topics have no single state topic, input discovery disabled"));
+      }
+      #endif
+    }
+  }
+
+  if (json.containsKey("knxPowerOnBroadcast"))
+  {
+    g_knxBroadcastEnabled = json["knxPowerOnBroadcast"].as<bool>();
+  }
+
+  if (json.containsKey("knxReadProxyMaxAgeMs"))
+  {
+    g_knxReadProxyMaxAgeMs = min(json["knxReadProxyMaxAgeMs"].as<uint32_t>(), (uint32_t)KNX_STATE_EXPIRY_MS);
+  }
+
+  if (json.containsKey("inputs"))
+  {
+    // Flush the KNX read queue before loading any input configuration
+    flushQueue();
+
+    for (JsonVariant input : json["inputs"].as<JsonArray>())
+    {
+      jsonInputConfig(input);
+    }
+
+    // Broadcast our input states once we have the first input config
+    if (g_knxBroadcastEnabled && !g_knxBroadcastDone && g_knxBroadcastArmedMs == 0)
+    {
+      g_knxBroadcastArmedMs = millis() | 1;
+    }
+  }
+
+  // Apply any input config changes to the display and input handlers
+  commitInputConfig();
+
+  // Handle any Home Assistant config
+  #if !defined(NO_HASS)
+  hass.parseConfig(json);
+  #endif
+}
+
+void applyBakedConfig()
+{
+#if defined(BAKED_CONFIG)
+  uint32_t startUs = micros();
+
+  // Same as a config payload, but straight from the generated tables
+  stageInputConfig();
+
+  if (BAKED_KNX_DEVICE_ADDRESS != 0)
+  {
+    g_knxDeviceAddress = BAKED_KNX_DEVICE_ADDRESS;
+    knx.setIndividualAddress(g_knxDeviceAddress);
+  }
+
+  setDefaultInputType(BAKED_DEFAULT_INPUT_TYPE);
+  g_eventTopicLayout = BAKED_EVENT_TOPIC_LAYOUT;
+  g_knxBroadcastEnabled = BAKED_KNX_POWER_ON_BROADCAST;
+  g_knxReadProxyMaxAgeMs = BAKED_KNX_READ_PROXY_MAX_AGE_MS;
+
+  for (uint8_t i = 0; i < BAKED_INPUT_COUNT; i++)
+  {
+    const BakedInput * baked = &BAKED_INPUTS[i];
+    if (baked->index == 0 || baked->index > getMaxIndex())
+      continue;
+
+    uint8_t mcp = (baked->index - 1) / MCP_PIN_COUNT;
+    uint8_t pin = (baked->index - 1) % MCP_PIN_COUNT;
+
+    setInputType(mcp, pin, baked->type);
+    setInputInvert(mcp, pin, baked->invert);
+    setInputDisabled(mcp, pin, baked->disabled);
+    g_inputConfigStaged[mcp].timing[pin] = baked->timing;
+
+    KnxConfig * config = &g_knxConfig[baked->index - 1];
+    config->commandAddress = baked->commandAddress;
+    config->stateAddress = baked->stateAddress;
+    config->failoverOnly = baked->failoverOnly;
+    config->verifyMs = min(baked->verifyMs, (uint16_t)KNX_VERIFY_MAX_MS);
+    config->readProxyMs = min(baked->readProxyMs, (uint16_t)KNX_READ_PROXY_MAX_MS);
+    config->secureKey = 0;
+    if (baked->secureKey != 0)
+    {
+      config->secureKey = knxSecure.addKey(BAKED_SECURE_KEYS[baked->secureKey - 1]);
+      if (config->secureKey == 0)
+      {
+        logEvent(LOG_SECURE_KEYS_FULL);
+      }
+    }
+    #if !defined(NO_HASS)
+    config->hassEntity = baked->hassEntity;
+    g_hassKnxDiscoveryPublished[baked->index - 1] = baked->hassEntity == HASS_ENTITY_NONE;
+    #endif
+
+    pushQueue(config->stateAddress);
+  }
+
+  commitInputConfig();
+
+  if (g_knxBroadcastEnabled && BAKED_INPUT_COUNT > 0)
+  {
+    g_knxBroadcastArmedMs = millis() | 1;
+  }
+
+  logger.print(F("[knx] baked config applied in "));
+  logger.print(micros() - startUs);
+  logger.println(F("us"));
+#endif
+}
+
+/**
+  Command handler
+ */
+void setCommandSchema()
+{
+  // Define our command schema
+  JsonDocument json;
+
+  JsonObject queryInputs = json["queryInputs"].to<JsonObject>();
+  queryInputs["title"] = "Query Inputs";
+  queryInputs["description"] = "Query and publish the state of all bi-stable inputs.";
+  queryInputs["type"] = "boolean";
+
+  JsonObject forceFailover = json["forceFailover"].to<JsonObject>();
+  forceFailover["title"] = "Force KNX";
+  forceFailover["description"] = "By-pass publishing input events to MQTT and always publish to KNX, regardless of IP/MQTT connection state.";
+  forceFailover["type"] = "boolean";
+
+  #if !defined(NO_HASS)
+  JsonObject hassStatus = json["hassStatus"].to<JsonObject>();
+  hassStatus["title"] = "Home Assistant Status";
+  hassStatus["description"] = "Relay the Home Assistant birth/will message (e.g. from an automation on ‘homeassistant/status’). Discovery config is only republished when Home Assistant comes online.";
+  JsonArray hassStatusEnum = hassStatus["enum"].to<JsonArray>();
+  hassStatusEnum.add("online");
+  hassStatusEnum.add("offline");
+  #endif
+
+  #if defined(MQTT_BENCHMARK)
+  JsonObject mqttBenchmark = json["mqttBenchmark"].to<JsonObject>();
+  mqttBenchmark["title"] = "MQTT Benchmark";
+  mqttBenchmark["description"] = "Publish synthetic events (type ‘benchmark’) to ‘<status>/benchmark’ at a fixed rate, then report sustained throughput, failures and publish latency via telemetry. Debug builds only.";
+  mqttBenchmark["type"] = "object";
+
+  JsonObject mqttBenchmarkProperties = mqttBenchmark["properties"].to<JsonObject>();
+
+  JsonObject benchmarkRate = mqttBenchmarkProperties["rate"].to<JsonObject>();
+  benchmarkRate["title"] = "Events Per Second";
+  benchmarkRate["type"] = "integer";
+  benchmarkRate["minimum"] = 1;
+  benchmarkRate["maximum"] = MQTT_BENCHMARK_MAX_RATE;
+
+  JsonObject benchmarkDurationMs = mqttBenchmarkProperties["durationMs"].to<JsonObject>();
+  benchmarkDurationMs["title"] = "Duration (ms)";
+  benchmarkDurationMs["type"] = "integer";
+  benchmarkDurationMs["minimum"] = 1000;
+  benchmarkDurationMs["maximum"] = MQTT_BENCHMARK_MAX_MS;
+  #endif
+
+  #if !defined(NO_REST)
+  JsonObject captureInput = json["captureInput"].to<JsonObject>();
+  captureInput["title"] = "Capture Input";
+  captureInput["description"] = "Record the raw signal of an input at the maximum scan rate, starting from its next edge, for diagnosing bouncing or noisy inputs. Download from ‘/capture’ on the REST API once complete, and analyse with scripts/capture_analyse.py. Set to 0 to cancel.";
+  captureInput["type"] = "integer";
+  captureInput["minimum"] = 0;
+  captureInput["maximum"] = getMaxIndex();
+  #endif
+
+  JsonObject knxCommands = json["knxCommands"].to<JsonObject>();
+  knxCommands["title"] = "KNX Commands";
+  knxCommands["description"] = "Send one or more telegrams directly onto the KNX bus.";
+  knxCommands["type"] = "array";
+  
+  JsonObject knxCommandItems = knxCommands["items"].to<JsonObject>();
+  knxCommandItems["type"] = "object";
+
+  JsonObject knxCommandProperties = knxCommandItems["properties"].to<JsonObject>();
+
+  JsonObject knxGroupAddress = knxCommandProperties["knxGroupAddress"].to<JsonObject>();
+  knxGroupAddress["title"] = "KNX Group Address";
+  knxGroupAddress["type"] = "string";
+  knxGroupAddress["pattern"] = "^\\d+\\/\\d+\\/\\d+$";
+
+  JsonObject knxValue = knxCommandProperties["knxValue"].to<JsonObject>();
+  knxValue["title"] = "KNX Value";
+  createKnxValueEnum(knxValue);
+
+  // Pass our command schema down to the hardware library
+  oxrs.setCommandSchema(json.as<JsonVariant>());
+}
+
+void jsonCommand(JsonVariant json)
+{
+  if (json.containsKey("queryInputs"))
+  {
+    g_queryInputs = json["queryInputs"].as<bool>();
+  }
+
+  if (json.containsKey("forceFailover"))
+  {
+    g_forceFailover = json["forceFailover"].as<bool>();
+  }
+
+  #if defined(MQTT_BENCHMARK)
+  if (json.containsKey("mqttBenchmark"))
+  {
+    startBenchmark(json["mqttBenchmark"]["rate"].as<uint16_t>(), json["mqttBenchmark"]["durationMs"].as<uint32_t>());
+  }
+  #endif
+
+  #if !defined(NO_HASS)
+  if (json.containsKey("hassStatus"))
+  {
+    // HA has (re)started so will have lost any non-retained state, republish
+    const char * status = json["hassStatus"];
+    if (status != NULL && strcmp(status, "online") == 0)
+    {
+      republishHassDiscovery();
+    }
+  }
+  #endif
+
+  #if !defined(NO_REST)
+  if (json.containsKey("captureInput"))
+  {
+    uint8_t index = json["captureInput"].as<uint8_t>();
+    startCapture(index <= getMaxIndex() ? index : 0);
+  }
+  #endif
+
+  if (json.containsKey("knxCommands"))
+  {
+    // Queue each command as we go, nothing is copied out of the payload (it
+    // has already been parsed by the OXRS library, so there is no parse of
+    // our own to filter)
+    uint16_t dropped = 0;
+    for (JsonVariant command : json["knxCommands"].as<JsonArray>())
+    {
+      uint16_t address = parseGroupAddress(command["knxGroupAddress"]);
+      const char * value = command["knxValue"];
+
+      bool queued = false;
+      if (address != 0 && value != NULL)
+      {
+        if (strcmp(value, "on") == 0)
+        {
+          queued = pushTxQueue(address, KNX_TX_WRITE_BOOL, true);
+        }
+        else if (strcmp(value, "off") == 0)
+        {
+          queued = pushTxQueue(address, KNX_TX_WRITE_BOOL, false);
+        }
+        else if (strcmp(value, "up") == 0)
+        {
+          queued = pushTxQueue(address, KNX_TX_WRITE_DIM, 0x08 | 5);
+        }
+        else if (strcmp(value, "down") == 0)
+        {
+          queued = pushTxQueue(address, KNX_TX_WRITE_DIM, 5);
+        }
+      }
+
+      if (!queued)
+      {
+        dropped++;
+      }
+    }
+
+    // Per-command log entries are rate limited, so always report the total
+    if (dropped > 0)
+    {
+      logEvent(LOG_COMMANDS_DROPPED, dropped);
+    }
+  }
+}
+
+bool isKnxEventSent(uint8_t index, uint8_t type, uint8_t state)
+{
+  // Will publishKnxEvent() queue a telegram for this event?
+  if (g_knxConfig[index - 1].commandAddress == 0)
+    return false;
+
+  // Nothing is queued while the BCU is down
+  if (g_knxBcuDown)
+    return false;
+
+  // Buttons only send on single-press
+  if (type == BUTTON && state != 1)
+    return false;
+
+  // Failover-only inputs only send if MQTT is down
+  if (g_knxConfig[index - 1].failoverOnly && !g_forceFailover && oxrs.getMQTT()->connected())
+    return false;
+
+  return true;
+}
+
+bool publishEvent(uint8_t index, uint8_t type, uint8_t state)
+{
+  // Each event sends at most one KNX telegram, so hold back events that
+  // will send one until the bus has room, rather than dropping it from the
+  // transmit queue (events that don't go to KNX aren't held up)
+  if (getTxQueueFree() == 0 && isKnxEventSent(index, type, state))
+    return false;
+
+  // Calculate the port and channel for this index (all 1-based)
+  uint8_t port = ((index - 1) / 4) + 1;
+  uint8_t channel = index - ((port - 1) * 4);
+  
+  char inputType[9];
+  getInputType(inputType, type);
+  char eventType[8];
+  getEventType(eventType, type, state);
+
+  JsonDocument json;
+  json["port"] = port;
+  json["channel"] = channel;
+  json["index"] = index;
+  json["type"] = inputType;
+  json["event"] = eventType;
+
+  // Always publish this event to MQTT, unless in forced failover
+  bool failover = g_forceFailover;
+  if (!failover)
+  {
+    failover = !publishEventJson(json.as<JsonVariant>(), inputType, eventType);
+  }
+
+  // Always publish this event to KNX, unless not in failover and failover-only enabled
+  if (failover || !g_knxConfig[index - 1].failoverOnly)
+  {
+    publishKnxEvent(index, type, state);
+  }
+
+  return true;
+}
+
+#if !defined(NO_HASS)
+bool publishHassDiscovery(uint8_t mcp)
+{
+  char component[16];
+  sprintf_P(component, PSTR("binary_sensor"));
+
+  char inputId[16];
+  char inputName[16];
+
+  char statusTopic[96];
+  char valueTemplate[128];
+
+  // Read security sensor values in quads (a full port)
+  uint8_t securityCount = 0;
+
+  for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+  {
+    // Determine the input type (from our config, the input handler has
+    // inputs with custom timing disabled)
+    uint8_t inputType = g_inputConfig[mcp].type[pin];
+
+    // Only generate config for the last security input
+    if (inputType == SECURITY)
+    {
+      if (++securityCount < 4) 
+        continue;
+      
+      securityCount = 0;
+    }
+
+    // Calculate the 1-based input index
+    uint8_t input = (MCP_PIN_COUNT * mcp) + pin + 1;
+
+    // Ignore if we have already published the discovery config for this input
+    if (g_hassDiscoveryPublished[input - 1])
+      continue;
+
+    // Only interested in CONTACT, SECURITY, SWITCH inputs
+    if (inputType != CONTACT && inputType != SECURITY && inputType != SWITCH)
+      continue;
+
+    // JSON config payload (empty if the input is disabled, or there is no
+    // state topic for it, to clear any existing config)
+    JsonDocument json;
+
+    sprintf_P(inputId, PSTR("input_%d"), input);
+
+    // Check if this input is disabled, or its events are split across
+    // per-event topics (there is no single state topic to point HA at)
+    if (!bitRead(g_inputConfig[mcp].disabled, pin) && g_eventTopicLayout != EVENT_TOPIC_EVENT)
+    {
+      hass.getDiscoveryJson(json, inputId);
+
+      sprintf_P(inputName, PSTR("Input %d"), input);
+      switch (inputType)
+      {
+        case CONTACT:
+          sprintf_P(valueTemplate, PSTR("{%% if value_json.index == %d %%}{%% if value_json.event == 'open' %%}ON{%% else %%}OFF{%% endif %%}{%% endif %%}"), input);
+          break;
+        case SECURITY:
+          sprintf_P(valueTemplate, PSTR("{%% if value_json.index == %d %%}{%% if value_json.event == 'alarm' %%}ON{%% else %%}OFF{%% endif %%}{%% endif %%}"), input);
+          break;
+        case SWITCH:
+          sprintf_P(valueTemplate, PSTR("{%% if value_json.index == %d %%}{%% if value_json.event == 'on' %%}ON{%% else %%}OFF{%% endif %%}{%% endif %%}"), input);
+          break;
+      }
+
+      char inputTypeName[9];
+      getInputType(inputTypeName, inputType);
+
+      json["name"] = inputName;
+      json["stat_t"] = getEventTopic(statusTopic, inputTypeName, NULL);
+      json["val_tpl"] = valueTemplate;
+    }
+
+    // Publish retained and stop trying once successful 
+    g_hassDiscoveryPublished[input - 1] = hass.publishDiscoveryJson(json, component, inputId);
+
+    // Only publish one config at a time so we don't flood the broker
+    return true;
+  }
+
+  // Nothing left to publish for this MCP
+  return false;
+}
+
+bool publishHassKnxDiscovery()
+{
+  char component[16];
+  char entityId[16];
+  char entityName[16];
+
+  char statusTopic[96];
+  char commandTopic[64];
+  char groupAddress[16];
+  char stateTemplate[128];
+  char commandOn[128];
+  char commandOff[128];
+
+  for (uint8_t i = 0; i < MAX_INPUT_COUNT; i++)
+  {
+    // Ignore if we have already published the discovery config for this actuator
+    if (g_hassKnxDiscoveryPublished[i])
+      continue;
+
+    KnxConfig * config = &g_knxConfig[i];
+    uint8_t input = i + 1;
+
+    // Need somewhere to send commands for this to be of any use
+    uint8_t entity = config->commandAddress == 0 ? HASS_ENTITY_NONE : config->hassEntity;
+
+    // JSON config payload (empty if no entity, to clear any existing config)
+    JsonDocument json;
+
+    sprintf_P(entityId, PSTR("knx_%d"), input);
+
+    // Clear any config for the other component, in case the entity type changed
+    JsonDocument empty;
+    sprintf_P(component, entity == HASS_ENTITY_LIGHT ? PSTR("switch") : PSTR("light"));
+    if (!hass.publishDiscoveryJson(empty, component, entityId))
+      return true;
+
+    sprintf_P(component, entity == HASS_ENTITY_LIGHT ? PSTR("light") : PSTR("switch"));
+
+    if (entity != HASS_ENTITY_NONE)
+    {
+      hass.getDiscoveryJson(json, entityId);
+
+      sprintf_P(entityName, PSTR("KNX %d"), input);
+
+      // Commands go via the KNX transmit queue using the knxCommands command
+      sprintf_P(groupAddress, PSTR("%d/%d/%d"), (config->commandAddress >> 11) & 0x1F, (config->commandAddress >> 8) & 0x07, config->commandAddress & 0xFF);
+      sprintf_P(commandOn, PSTR("{\"knxCommands\":[{\"knxGroupAddress\":\"%s\",\"knxValue\":\"on\"}]}"), groupAddress);
+      sprintf_P(commandOff, PSTR("{\"knxCommands\":[{\"knxGroupAddress\":\"%s\",\"knxValue\":\"off\"}]}"), groupAddress);
+
+      // State comes from our KNX cache, see publishKnxState()
+      sprintf_P(stateTemplate, PSTR("{%% if value_json.index == %d and value_json.knxState is defined %%}{{ value_json.knxState }}{%% endif %%}"), input);
+
+      json["name"] = entityName;
+      json["stat_t"] = getKnxStateTopic(statusTopic);
+      json["cmd_t"] = oxrs.getMQTT()->getCommandTopic(commandTopic);
+
+      if (entity == HASS_ENTITY_LIGHT)
+      {
+        json["schema"] = "template";
+        json["stat_tpl"] = stateTemplate;
+        json["cmd_on_tpl"] = commandOn;
+        json["cmd_off_tpl"] = commandOff;
+      }
+      else
+      {
+        json["val_tpl"] = stateTemplate;
+        json["stat_on"] = "on";
+        json["stat_off"] = "off";
+        json["pl_on"] = commandOn;
+        json["pl_off"] = commandOff;
+      }
+    }
+
+    // Publish retained and stop trying once successful 
+    g_hassKnxDiscoveryPublished[i] = hass.publishDiscoveryJson(json, component, entityId);
+
+    // Let HA know the current state straight away
+    if (g_hassKnxDiscoveryPublished[i] && entity != HASS_ENTITY_NONE && config->lastStateUpdateMs != 0)
+    {
+      publishKnxState(input);
+    }
+
+    // Only publish one config at a time so we don't flood the broker
+    return true;
+  }
+
+  // Nothing left to publish
+  return false;
+}
+
+void loopHassDiscovery()
+{
+  // Nothing to do unless something needs (re)publishing
+  if (!g_hassDiscoveryPending)
+    return;
+
+  if (!hass.isDiscoveryEnabled())
+    return;
+
+  // Pace the discovery payloads
+  if ((millis() - g_hassDiscoveryLastMs) < HASS_DISCOVERY_INTERVAL_MS)
+    return;
+
+  g_hassDiscoveryLastMs = millis();
+
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    if (bitRead(g_mcps_found, mcp) == 0)
+      continue;
+
+    if (publishHassDiscovery(mcp))
+      return;
+  }
+
+  if (publishHassKnxDiscovery())
+    return;
+
+  // Everything is published, nothing more to do until HA restarts or the
+  // config changes
+  g_hassDiscoveryPending = false;
+}
+#endif
+
+/**
+  Event handlers
+*/
+void inputEvent(uint8_t id, uint8_t input, uint8_t type, uint8_t state)
+{
+  // Determine the index for this input event (1-based)
+  uint8_t mcp = id;
+  uint8_t index = (MCP_PIN_COUNT * mcp) + input + 1;
 
-    for (JsonVariant input : json["inputs"].as<JsonArray>())
+  // Capturing states for the power-on broadcast, not a real event
+  if (g_knxBroadcastCapture)
+  {
+    if (g_knxBroadcastState[index - 1] == KNX_BROADCAST_NONE)
     {
-      jsonInputConfig(input);
+      g_knxBroadcastRemaining++;
     }
+
+    g_knxBroadcastState[index - 1] = state;
+    return;
   }
 
-  // Handle any Home Assistant config
-  hass.parseConfig(json);
+  // Queue the event, it is published from the main loop
+  eventQueue.push(index, type, state);
 }
 
-/**
-  Command handler
- */
-void setCommandSchema()
+void decodeRotaryInputs(uint8_t mcp, uint16_t io_value)
 {
-  // Define our command schema
-  JsonDocument json;
+  uint16_t mask = g_rotaryMask[mcp];
 
-  JsonObject queryInputs = json["queryInputs"].to<JsonObject>();
-  queryInputs["title"] = "Query Inputs";
-  queryInputs["description"] = "Query and publish the state of all bi-stable inputs.";
-  queryInputs["type"] = "boolean";
+  for (uint8_t pin = 0; pin < MCP_PIN_COUNT && mask != 0; pin += 2)
+  {
+    if (!bitRead(mask, pin))
+      continue;
 
-  JsonObject forceFailover = json["forceFailover"].to<JsonObject>();
-  forceFailover["title"] = "Force KNX";
-  forceFailover["description"] = "By-pass publishing input events to MQTT and always publish to KNX, regardless of IP/MQTT connection state.";
-  forceFailover["type"] = "boolean";
+    // A on the even pin, B on the odd pin
+    uint8_t encoder = pin / 2;
+    uint8_t current = (io_value >> pin) & 0b11;
+    uint8_t previous = g_rotaryState[mcp][encoder];
 
-  JsonObject knxCommands = json["knxCommands"].to<JsonObject>();
-  knxCommands["title"] = "KNX Commands";
-  knxCommands["description"] = "Send one or more telegrams directly onto the KNX bus.";
-  knxCommands["type"] = "array";
-  
-  JsonObject knxCommandItems = knxCommands["items"].to<JsonObject>();
-  knxCommandItems["type"] = "object";
+    g_rotaryState[mcp][encoder] = current;
+    if (previous == 0xFF || previous == current)
+      continue;
 
-  JsonObject knxCommandProperties = knxCommandItems["properties"].to<JsonObject>();
+    g_rotaryTransitions++;
 
-  JsonObject knxGroupAddress = knxCommandProperties["knxGroupAddress"].to<JsonObject>();
-  knxGroupAddress["title"] = "KNX Group Address";
-  knxGroupAddress["type"] = "string";
-  knxGroupAddress["pattern"] = "^\\d+\\/\\d+\\/\\d+$";
+    int8_t step = ROTARY_TABLE[(previous << 2) | current];
+    if (step == ROTARY_INVALID)
+    {
+      // We sampled too slowly to see which way it went
+      g_rotaryInvalid++;
+      continue;
+    }
 
-  JsonObject knxValue = knxCommandProperties["knxValue"].to<JsonObject>();
-  knxValue["title"] = "KNX Value";
-  createKnxValueEnum(knxValue);
+    g_rotarySteps[mcp][encoder] += step;
 
-  // Pass our command schema down to the hardware library
-  oxrs.setCommandSchema(json.as<JsonVariant>());
+    // Hand each detent to the main loop, which emits the up/down events
+    if (abs(g_rotarySteps[mcp][encoder]) >= ROTARY_TRANSITIONS_PER_DETENT)
+    {
+      portENTER_CRITICAL(&g_rotaryMux);
+      int8_t detents = g_rotaryDetents[mcp][encoder];
+      if (g_rotarySteps[mcp][encoder] > 0 && detents < INT8_MAX) { detents++; }
+      if (g_rotarySteps[mcp][encoder] < 0 && detents > INT8_MIN) { detents--; }
+      g_rotaryDetents[mcp][encoder] = detents;
+      portEXIT_CRITICAL(&g_rotaryMux);
+
+      g_rotarySteps[mcp][encoder] = 0;
+    }
+  }
 }
 
-void jsonCommand(JsonVariant json)
+void rotaryTask(void * parameter)
 {
-  if (json.containsKey("queryInputs"))
-  {
-    g_queryInputs = json["queryInputs"].as<bool>();
-  }
+  // Sample only the MCPs with encoders, at a fixed rate whatever the main
+  // loop is doing, so encoder transitions aren't missed
+  TickType_t lastWakeTicks = xTaskGetTickCount();
 
-  if (json.containsKey("forceFailover"))
+  for (;;)
   {
-    g_forceFailover = json["forceFailover"].as<bool>();
+    // Late for this sample, e.g. the bus was held by the main loop
+    if (xTaskDelayUntil(&lastWakeTicks, pdMS_TO_TICKS(ROTARY_SCAN_MS)) == pdFALSE)
+    {
+      g_rotaryOverruns++;
+    }
+
+    for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+    {
+      if (g_rotaryMask[mcp] == 0)
+        continue;
+
+      xSemaphoreTake(g_mcpMutex, portMAX_DELAY);
+      decodeRotaryInputs(mcp, mcp23017[mcp].readGPIOAB());
+      xSemaphoreGive(g_mcpMutex);
+    }
   }
+}
 
-  if (json.containsKey("knxCommands"))
+void loopRotaryInputs()
+{
+  int8_t detents[MCP_COUNT][MCP_PIN_COUNT / 2];
+
+  portENTER_CRITICAL(&g_rotaryMux);
+  memcpy(detents, g_rotaryDetents, sizeof(detents));
+  memset(g_rotaryDetents, 0, sizeof(g_rotaryDetents));
+  portEXIT_CRITICAL(&g_rotaryMux);
+
+  // Emit a single up/down event for each detent
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
   {
-    for (JsonVariant command : json["knxCommands"].as<JsonArray>())
+    for (uint8_t encoder = 0; encoder < MCP_PIN_COUNT / 2; encoder++)
     {
-      uint16_t address = parseGroupAddress(command["knxGroupAddress"]);
+      for (int8_t i = detents[mcp][encoder]; i > 0; i--)
+      {
+        inputEvent(mcp, encoder * 2, ROTARY, LOW_EVENT);
+      }
+
+      for (int8_t i = detents[mcp][encoder]; i < 0; i++)
+      {
+        inputEvent(mcp, encoder * 2, ROTARY, HIGH_EVENT);
+      }
+    }
+  }
+}
+
+void timedInputChanged(uint8_t mcp, uint8_t pin, TimedInput * input)
+{
+  uint8_t type = g_inputConfig[mcp].type[pin];
 
-      if (strcmp(command["knxValue"], "on") == 0)
+  switch (type)
+  {
+    case BUTTON:
+      if (input->level)
+      {
+        input->held = 0;
+      }
+      else if (input->held)
       {
-        knx.groupWriteBool(address, true);
+        inputEvent(mcp, pin, type, RELEASE_EVENT);
+        input->held = 0;
       }
-      else if (strcmp(command["knxValue"], "off") == 0)
+      else if (++input->clicks >= INPUT_MAX_CLICKS)
       {
-        knx.groupWriteBool(address, false);
+        inputEvent(mcp, pin, type, input->clicks);
+        input->clicks = 0;
       }
-      else if (strcmp(command["knxValue"], "up") == 0)
+      break;
+    case CONTACT:
+    case SWITCH:
+      inputEvent(mcp, pin, type, input->level ? LOW_EVENT : HIGH_EVENT);
+      break;
+    case PRESS:
+      if (input->level)
       {
-        knx.groupWrite4BitDim(address, true, 5);
+        inputEvent(mcp, pin, type, LOW_EVENT);
       }
-      else if (strcmp(command["knxValue"], "down") == 0)
+      break;
+    case TOGGLE:
+      if (input->level)
       {
-        knx.groupWrite4BitDim(address, false, 5);
+        input->toggle = !input->toggle;
+        inputEvent(mcp, pin, type, input->toggle ? LOW_EVENT : HIGH_EVENT);
       }
-    }
+      break;
   }
 }
 
-void publishEvent(uint8_t index, uint8_t type, uint8_t state)
+void processTimedInputs(uint8_t mcp, uint16_t io_value)
 {
-  // Calculate the port and channel for this index (all 1-based)
-  uint8_t port = ((index - 1) / 4) + 1;
-  uint8_t channel = index - ((port - 1) * 4);
-  
-  char inputType[9];
-  getInputType(inputType, type);
-  char eventType[8];
-  getEventType(eventType, type, state);
+  uint16_t mask = g_timedMask[mcp];
+  if (mask == 0)
+    return;
 
-  JsonDocument json;
-  json["port"] = port;
-  json["channel"] = channel;
-  json["index"] = index;
-  json["type"] = inputType;
-  json["event"] = eventType;
+  InputConfig * config = &g_inputConfig[mcp];
+  uint16_t now = millis();
 
-  // Always publish this event to MQTT, unless in forced failover
-  bool failover = g_forceFailover;
-  if (!failover)
+  for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
   {
-    failover = !oxrs.publishStatus(json.as<JsonVariant>());
-  }
+    if (!bitRead(mask, pin))
+      continue;
 
-  // Always publish this event to KNX, unless not in failover and failover-only enabled
-  if (failover || !g_knxConfig[index - 1].failoverOnly)
-  {
-    publishKnxEvent(index, type, state);
-  }
-}
+    TimedInput * input = &g_timedInputs[(MCP_PIN_COUNT * mcp) + pin];
+    InputTiming * timing = &config->timing[pin];
 
-void publishHassDiscovery(uint8_t mcp)
-{
-  char component[16];
-  sprintf_P(component, PSTR("binary_sensor"));
+    // Inputs are active low, unless inverted
+    uint8_t raw = !bitRead(io_value, pin) ^ bitRead(config->invert, pin);
 
-  char inputId[16];
-  char inputName[16];
+    // Take the first reading as the current state, nothing has changed yet
+    if (!input->known)
+    {
+      input->known = 1;
+      input->raw = input->level = raw;
+      input->rawMs = input->levelMs = now;
+      continue;
+    }
 
-  char statusTopic[64];
-  char valueTemplate[128];
+    if (raw != input->raw)
+    {
+      input->raw = raw;
+      input->rawMs = now;
+    }
 
-  // Read security sensor values in quads (a full port)
-  uint8_t securityCount = 0;
+    // Report the change once the input has been stable for long enough
+    uint16_t debounceMs = timing->debounce ? timing->debounce : INPUT_DEBOUNCE_MS;
+    if (input->level != raw && (uint16_t)(now - input->rawMs) >= debounceMs)
+    {
+      input->level = raw;
+      input->levelMs = now;
+      timedInputChanged(mcp, pin, input);
+    }
+
+    // Buttons also report holds, and click counts once the window closes
+    if (config->type[pin] != BUTTON)
+      continue;
+
+    uint16_t sinceMs = now - input->levelMs;
+    if (input->level && !input->held)
+    {
+      uint16_t holdMs = timing->hold ? timing->hold * INPUT_HOLD_UNIT_MS : INPUT_HOLD_MS;
+      if (sinceMs >= holdMs)
+      {
+        inputEvent(mcp, pin, BUTTON, HOLD_EVENT);
+        input->held = 1;
+        input->clicks = 0;
+      }
+    }
+    else if (!input->level && input->clicks > 0)
+    {
+      uint16_t clickMs = timing->click ? timing->click * INPUT_CLICK_UNIT_MS : INPUT_MULTI_CLICK_MS;
+      if (sinceMs >= clickMs)
+      {
+        inputEvent(mcp, pin, BUTTON, input->clicks);
+        input->clicks = 0;
+      }
+    }
+  }
+}
 
+void queryTimedInputs(uint8_t mcp)
+{
+  // Same as the input handler query, the current state of bi-stable inputs
   for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
   {
-    // Determine the input type
-    uint8_t inputType = oxrsInput[mcp].getType(pin);
+    if (!bitRead(g_timedMask[mcp], pin))
+      continue;
 
-    // Only generate config for the last security input
-    if (inputType == SECURITY)
+    TimedInput * input = &g_timedInputs[(MCP_PIN_COUNT * mcp) + pin];
+    uint8_t type = g_inputConfig[mcp].type[pin];
+
+    if (input->known && (type == CONTACT || type == SWITCH))
     {
-      if (++securityCount < 4) 
-        continue;
-      
-      securityCount = 0;
+      inputEvent(mcp, pin, type, input->level ? LOW_EVENT : HIGH_EVENT);
     }
+  }
+}
 
-    // Calculate the 1-based input index
-    uint8_t input = (MCP_PIN_COUNT * mcp) + pin + 1;
+void loopEvents()
+{
+  // Publish a bounded number of events per loop so an event storm can't
+  // stall input scanning or KNX processing
+  eventQueue.drain(EVENT_DRAIN_PER_LOOP, publishEvent);
+}
 
-    // Ignore if we have already published the discovery config for this input
-    if (g_hassDiscoveryPublished[input - 1])
-      continue;
+void captureKnxBroadcast()
+{
+  memset(g_knxBroadcastState, KNX_BROADCAST_NONE, sizeof(g_knxBroadcastState));
+  g_knxBroadcastRemaining = 0;
 
-    // Only interested in CONTACT, SECURITY, SWITCH inputs
-    if (inputType != CONTACT && inputType != SECURITY && inputType != SWITCH)
+  // Query all bi-stable inputs, the events are captured by inputEvent()
+  // rather than being published
+  g_knxBroadcastCapture = true;
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    if (bitRead(g_mcps_found, mcp) == 0)
       continue;
 
-    // JSON config payload (empty if the input is disabled, to clear any existing config)
-    JsonDocument json;
-
-    sprintf_P(inputId, PSTR("input_%d"), input);
+    oxrsInput[mcp].queryAll(mcp);
+    queryTimedInputs(mcp);
+  }
+  g_knxBroadcastCapture = false;
 
-    // Check if this input is disabled
-    if (!oxrsInput[mcp].getDisabled(pin))
-    {
-      hass.getDiscoveryJson(json, inputId);
+  g_knxBroadcastDone = true;
 
-      sprintf_P(inputName, PSTR("Input %d"), input);
-      switch (inputType)
-      {
-        case CONTACT:
-          sprintf_P(valueTemplate, PSTR("{%% if value_json.index == %d %%}{%% if value_json.event == 'open' %%}ON{%% else %%}OFF{%% endif %%}{%% endif %%}"), input);
-          break;
-        case SECURITY:
-          sprintf_P(valueTemplate, PSTR("{%% if value_json.index == %d %%}{%% if value_json.event == 'alarm' %%}ON{%% else %%}OFF{%% endif %%}{%% endif %%}"), input);
-          break;
-        case SWITCH:
-          sprintf_P(valueTemplate, PSTR("{%% if value_json.index == %d %%}{%% if value_json.event == 'on' %%}ON{%% else %%}OFF{%% endif %%}{%% endif %%}"), input);
-          break;
-      }
+  logger.print(F("[knx] broadcasting power-on state of "));
+  logger.print(g_knxBroadcastRemaining);
+  logger.println(F(" inputs"));
+}
 
-      json["name"] = inputName;
-      json["stat_t"] = oxrs.getMQTT()->getStatusTopic(statusTopic);
-      json["val_tpl"] = valueTemplate;
-    }
+uint8_t nextKnxBroadcast()
+{
+  // Security inputs first, then everything else in index order
+  for (uint8_t i = 0; i < MAX_INPUT_COUNT; i++)
+  {
+    if (g_knxBroadcastState[i] != KNX_BROADCAST_NONE && g_inputConfig[i / MCP_PIN_COUNT].type[i % MCP_PIN_COUNT] == SECURITY)
+      return i + 1;
+  }
 
-    // Publish retained and stop trying once successful 
-    g_hassDiscoveryPublished[input - 1] = hass.publishDiscoveryJson(json, component, inputId);
+  for (uint8_t i = 0; i < MAX_INPUT_COUNT; i++)
+  {
+    if (g_knxBroadcastState[i] != KNX_BROADCAST_NONE)
+      return i + 1;
   }
+
+  return 0;
 }
 
-/**
-  Event handlers
-*/
-void inputEvent(uint8_t id, uint8_t input, uint8_t type, uint8_t state)
+void loopKnxBroadcast()
 {
-  // Determine the index for this input event (1-based)
-  uint8_t mcp = id;
-  uint8_t index = (MCP_PIN_COUNT * mcp) + input + 1;
+  // Capture the input states once they have settled after the first config
+  if (g_knxBroadcastArmedMs != 0 && (millis() - g_knxBroadcastArmedMs) > KNX_BROADCAST_DELAY_MS)
+  {
+    g_knxBroadcastArmedMs = 0;
+    captureKnxBroadcast();
+  }
+
+  if (g_knxBroadcastRemaining == 0)
+    return;
+
+  // Hold off while the BCU is down, and let any live telegrams go first
+  if (g_knxBcuDown || !isKnxTxIdle())
+    return;
+
+  // Pace the broadcast so it never bursts onto the bus
+  if ((millis() - g_knxBroadcastLastMs) < KNX_BROADCAST_INTERVAL_MS)
+    return;
+
+  uint8_t index = nextKnxBroadcast();
+  if (index == 0)
+  {
+    g_knxBroadcastRemaining = 0;
+    return;
+  }
 
-  // Publish the event
-  publishEvent(index, type, state);
+  uint8_t state = g_knxBroadcastState[index - 1];
+  g_knxBroadcastState[index - 1] = KNX_BROADCAST_NONE;
+  g_knxBroadcastRemaining--;
+
+  // Nothing to send to, and failover-only inputs are left alone unless we
+  // are forcing failover
+  if (g_knxConfig[index - 1].commandAddress == 0)
+    return;
+
+  if (g_knxConfig[index - 1].failoverOnly && !g_forceFailover)
+    return;
+
+  uint8_t type = g_inputConfig[(index - 1) / MCP_PIN_COUNT].type[(index - 1) % MCP_PIN_COUNT];
+  if (type != CONTACT && type != SECURITY && type != SWITCH)
+    return;
+
+  publishKnxEvent(index, type, state);
+  g_knxBroadcastLastMs = millis();
+  g_knxBroadcastSent++;
 }
 
 /**
@@ -1027,13 +3694,13 @@ void inputEvent(uint8_t id, uint8_t input, uint8_t type, uint8_t state)
 */
 void scanI2CBus()
 {
-  oxrs.println(F("[knx] scanning for I/O buffers..."));
+  logger.println(F("[knx] scanning for I/O buffers..."));
 
   for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
   {
-    oxrs.print(F(" - 0x"));
-    oxrs.print(MCP_I2C_ADDRESS[mcp], HEX);
-    oxrs.print(F("..."));
+    logger.print(F(" - 0x"));
+    logger.print(MCP_I2C_ADDRESS[mcp], HEX);
+    logger.print(F("..."));
 
     // Check if there is anything responding on this address
     Wire.beginTransmission(MCP_I2C_ADDRESS[mcp]);
@@ -1050,14 +3717,15 @@ void scanI2CBus()
 
       // Initialise input handlers (default to SWITCH)
       oxrsInput[mcp].begin(inputEvent, SWITCH);
+      memset(g_inputConfig[mcp].type, SWITCH, MCP_PIN_COUNT);
 
-      oxrs.print(F("MCP23017"));
-      if (MCP_INTERNAL_PULLUPS) { oxrs.print(F(" (internal pullups)")); }
-      oxrs.println();
+      logger.print(F("MCP23017"));
+      if (MCP_INTERNAL_PULLUPS) { logger.print(F(" (internal pullups)")); }
+      logger.println();
     }
     else
     {
-      oxrs.println(F("empty"));
+      logger.println(F("empty"));
     }
   }
 }
@@ -1072,15 +3740,33 @@ void setup()
   delay(1000);
   Serial.println(F("[knx] starting up..."));
 
+  // Guards the MCPs once the rotary task is sampling them
+  g_mcpMutex = xSemaphoreCreateMutex();
+
   // Start the I2C bus
   Wire.begin(I2C_SDA, I2C_SCL);
 
   // Scan the I2C bus and set up I/O buffers
   scanI2CBus();
 
+  // No KNX actuator entities until configured
+  #if !defined(NO_HASS)
+  memset(g_hassKnxDiscoveryPublished, 1, sizeof(g_hassKnxDiscoveryPublished));
+  #endif
+
+  // Apply any config baked in at build time before the hardware starts, so
+  // it only provides defaults. Any persisted config (restored by begin())
+  // and later MQTT config are applied on top of it and take precedence.
+  applyBakedConfig();
+
   // Start hardware
   oxrs.begin(jsonConfig, jsonCommand);
 
+  // Add any REST API endpoints
+  #if !defined(NO_REST)
+  oxrs.apiGet("/capture", &apiCapture);
+  #endif
+
   // Set up port display
   #if defined(OXRS_LCD_ENABLE)
   oxrs.getLCD()->drawPorts(PORT_LAYOUT_INPUT_AUTO, g_mcps_found);
@@ -1093,6 +3779,9 @@ void setup()
   // Speed up I2C clock for faster scan rate (after bus scan)
   Wire.setClock(I2C_CLOCK_SPEED);
 
+  // Start sampling any encoders (none until configured as ROTARY)
+  xTaskCreatePinnedToCore(rotaryTask, "rotary", ROTARY_TASK_STACK, NULL, ROTARY_TASK_PRIORITY, NULL, ARDUINO_RUNNING_CORE);
+
   // Set up KNX callbacks and serial comms to BCU
   initialiseKnx();
 }
@@ -1102,6 +3791,8 @@ void setup()
 */
 void loop()
 {
+  uint32_t loopStartUs = micros();
+
   // Let hardware handle any events etc
   oxrs.loop();
 
@@ -1112,32 +3803,66 @@ void loop()
       continue;
 
     // Read the values for all 16 pins on this MCP
+    xSemaphoreTake(g_mcpMutex, portMAX_DELAY);
     uint16_t io_value = mcp23017[mcp].readGPIOAB();
+    xSemaphoreGive(g_mcpMutex);
 
     // Show port animations
     #if defined(OXRS_LCD_ENABLE)
     oxrs.getLCD()->process(mcp, io_value);
     #endif
 
-    // Check for any input events
-    oxrsInput[mcp].process(mcp, io_value);
+    // Record any waveform capture for an input on this MCP
+    #if !defined(NO_REST)
+    checkCapture(mcp, io_value);
+    #endif
+
+    // Check for any input events, encoders are decoded by the rotary task
+    // so the input handler sees them as idle
+    oxrsInput[mcp].process(mcp, io_value | g_rotaryMask[mcp]);
+    processTimedInputs(mcp, io_value);
 
     // Check if we are querying the current values
     if (g_queryInputs)
     {
       oxrsInput[mcp].queryAll(mcp);
-    }
-
-    // Check if we need to publish any Home Assistant discovery payloads
-    if (hass.isDiscoveryEnabled())
-    {
-      publishHassDiscovery(mcp);
+      queryTimedInputs(mcp);
     }
   }
 
   // Ensure we don't keep querying
   g_queryInputs = false;
 
+  // Queue events for any encoder detents
+  loopRotaryInputs();
+
+  // Publish any queued input events
+  loopEvents();
+
+  // Generate any synthetic MQTT load
+  #if defined(MQTT_BENCHMARK)
+  loopBenchmark();
+  #endif
+
+  // Check if we need to publish any Home Assistant discovery payloads
+  #if !defined(NO_HASS)
+  loopHassDiscovery();
+  #endif
+
   // Check for KNX events
   loopKnx();
+
+  // Send any power-on state broadcast to KNX
+  loopKnxBroadcast();
+
+  // Flush any buffered log events
+  loopLog();
+
+  // Publish diagnostics
+  if ((millis() - g_telemetryLastMs) > TELEMETRY_MS)
+  {
+    publishTelemetry();
+  }
+
+  g_loopMaxUs = max(g_loopMaxUs, (uint32_t)(micros() - loopStartUs));
 }
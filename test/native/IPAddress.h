@@ -0,0 +1,27 @@
+/**
+  Minimal Arduino IPAddress for host tests (pio test -e native)
+
+  Copyright 2023 Ben Jones <ben.jones12@gmail.com>
+*/
+
+#ifndef IPADDRESS_H
+#define IPADDRESS_H
+
+#include <stdint.h>
+
+class IPAddress
+{
+  public:
+    IPAddress() : _address{ 0, 0, 0, 0 } {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _address{ a, b, c, d } {}
+
+    uint8_t operator[](int index) const { return _address[index]; }
+    uint8_t & operator[](int index) { return _address[index]; }
+
+    uint8_t * raw_address() { return _address; }
+
+  private:
+    uint8_t _address[4];
+};
+
+#endif
@@ -0,0 +1,173 @@
+/**
+  Arduino Client over a POSIX TCP socket for host tests (pio test -e native)
+
+  Blocking writes with a timeout and a small send buffer, so a stalled
+  broker backs up into publish() much like it does on the ESP32 network
+  stacks (which only have a few KB of TCP send buffer).
+
+  Copyright 2023 Ben Jones <ben.jones12@gmail.com>
+*/
+
+#ifndef POSIX_CLIENT_H
+#define POSIX_CLIENT_H
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "Client.h"
+
+class PosixClient : public Client
+{
+  public:
+    PosixClient(int sendBufferBytes, int writeTimeoutMs)
+    {
+      _fd = -1;
+      _sendBufferBytes = sendBufferBytes;
+      _writeTimeoutMs = writeTimeoutMs;
+    }
+
+    ~PosixClient() { stop(); }
+
+    int connect(IPAddress ip, uint16_t port)
+    {
+      char host[16];
+      snprintf(host, sizeof(host), "%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
+      return connect(host, port);
+    }
+
+    int connect(const char * host, uint16_t port)
+    {
+      stop();
+
+      struct addrinfo hints = {};
+      struct addrinfo * result;
+      hints.ai_family = AF_INET;
+      hints.ai_socktype = SOCK_STREAM;
+
+      char service[6];
+      snprintf(service, sizeof(service), "%u", port);
+      if (getaddrinfo(host, service, &hints, &result) != 0)
+        return 0;
+
+      _fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+      if (_fd >= 0)
+      {
+        int noDelay = 1;
+        setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        setsockopt(_fd, SOL_SOCKET, SO_SNDBUF, &_sendBufferBytes, sizeof(_sendBufferBytes));
+
+        struct timeval timeout = { _writeTimeoutMs / 1000, (_writeTimeoutMs % 1000) * 1000 };
+        setsockopt(_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        if (::connect(_fd, result->ai_addr, result->ai_addrlen) != 0)
+        {
+          stop();
+        }
+      }
+
+      freeaddrinfo(result);
+      return _fd >= 0;
+    }
+
+    size_t write(uint8_t b) { return write(&b, 1); }
+
+    size_t write(const uint8_t * buffer, size_t size)
+    {
+      if (_fd < 0)
+        return 0;
+
+      size_t sent = 0;
+      while (sent < size)
+      {
+        ssize_t n = send(_fd, buffer + sent, size - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+          // Timed out or the connection is gone, either way it's dead
+          stop();
+          break;
+        }
+        sent += n;
+      }
+
+      return sent;
+    }
+
+    int available()
+    {
+      int count = 0;
+      if (_fd < 0 || ioctl(_fd, FIONREAD, &count) != 0)
+        return 0;
+
+      return count;
+    }
+
+    int read()
+    {
+      uint8_t b;
+      return read(&b, 1) == 1 ? b : -1;
+    }
+
+    int read(uint8_t * buffer, size_t size)
+    {
+      if (_fd < 0)
+        return -1;
+
+      ssize_t n = recv(_fd, buffer, size, MSG_DONTWAIT);
+      if (n == 0)
+      {
+        stop();
+      }
+      return n > 0 ? n : -1;
+    }
+
+    int peek()
+    {
+      uint8_t b;
+      if (_fd < 0 || recv(_fd, &b, 1, MSG_PEEK | MSG_DONTWAIT) != 1)
+        return -1;
+
+      return b;
+    }
+
+    void flush() {}
+
+    void stop()
+    {
+      if (_fd >= 0)
+      {
+        close(_fd);
+        _fd = -1;
+      }
+    }
+
+    uint8_t connected()
+    {
+      if (_fd < 0)
+        return 0;
+
+      // A zero length read means the peer closed the connection
+      uint8_t b;
+      ssize_t n = recv(_fd, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+      if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+      {
+        stop();
+        return 0;
+      }
+
+      return 1;
+    }
+
+    operator bool() { return _fd >= 0; }
+
+  private:
+    int _fd;
+    int _sendBufferBytes;
+    int _writeTimeoutMs;
+};
+
+#endif
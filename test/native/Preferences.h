@@ -0,0 +1,72 @@
+/**
+  In-memory NVS for host tests (pio test -e native)
+
+  Values outlive the Preferences instance (as they would a reboot) until
+  the namespace is cleared.
+
+  Copyright 2023 Ben Jones <ben.jones12@gmail.com>
+*/
+
+#ifndef PREFERENCES_H
+#define PREFERENCES_H
+
+#include <stdint.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+class Preferences
+{
+  public:
+    bool begin(const char * name)
+    {
+      _namespace = name;
+      return true;
+    }
+
+    bool clear()
+    {
+      _storage()[_namespace].clear();
+      return true;
+    }
+
+    uint64_t getULong64(const char * key, uint64_t defaultValue)
+    {
+      uint64_t value;
+      return getBytes(key, &value, sizeof(value)) == sizeof(value) ? value : defaultValue;
+    }
+
+    size_t putULong64(const char * key, uint64_t value)
+    {
+      return putBytes(key, &value, sizeof(value));
+    }
+
+    size_t getBytes(const char * key, void * buffer, size_t length)
+    {
+      std::map<std::string, std::vector<uint8_t>> & values = _storage()[_namespace];
+      if (!values.count(key) || values[key].size() > length)
+        return 0;
+
+      memcpy(buffer, values[key].data(), values[key].size());
+      return values[key].size();
+    }
+
+    size_t putBytes(const char * key, const void * buffer, size_t length)
+    {
+      const uint8_t * data = (const uint8_t *)buffer;
+      _storage()[_namespace][key].assign(data, data + length);
+      return length;
+    }
+
+  private:
+    std::string _namespace;
+
+    static std::map<std::string, std::map<std::string, std::vector<uint8_t>>> & _storage()
+    {
+      static std::map<std::string, std::map<std::string, std::vector<uint8_t>>> storage;
+      return storage;
+    }
+};
+
+#endif
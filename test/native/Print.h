@@ -0,0 +1,29 @@
+/**
+  Minimal Arduino Print for host tests (pio test -e native)
+
+  Copyright 2023 Ben Jones <ben.jones12@gmail.com>
+*/
+
+#ifndef PRINT_H
+#define PRINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class Print
+{
+  public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t b) = 0;
+    virtual size_t write(const uint8_t * buffer, size_t size)
+    {
+      size_t n = 0;
+      while (n < size && write(buffer[n])) { n++; }
+      return n;
+    }
+
+    virtual void flush() {}
+};
+
+#endif
@@ -0,0 +1,247 @@
+/**
+  Host tests for the input event queue (pio test -e native)
+
+  Copyright 2023 Ben Jones <ben.jones12@gmail.com>
+*/
+
+#include <unity.h>
+#include <chrono>
+#include "EventQueue.h"
+
+// Input types, as defined by the input handler
+#define       CONTACT               1
+#define       BUTTON                0
+#define       SECURITY              4
+#define       SWITCH                5
+
+#define       DRAIN_PER_LOOP        4
+#define       INPUT_COUNT           128
+
+// Events seen by the publisher
+uint16_t g_published = 0;
+uint16_t g_securityPublished = 0;
+uint8_t  g_lastState[INPUT_COUNT + 1];
+
+bool publish(uint8_t index, uint8_t type, uint8_t state)
+{
+  g_published++;
+  if (type == SECURITY)
+  {
+    g_securityPublished++;
+  }
+
+  g_lastState[index] = state;
+  return true;
+}
+
+// Holds back every event for input 1 (e.g. waiting on the KNX bus)
+bool publishHoldingInput1(uint8_t index, uint8_t type, uint8_t state)
+{
+  if (index == 1)
+    return false;
+
+  return publish(index, type, state);
+}
+
+void setUp()
+{
+  g_published = 0;
+  g_securityPublished = 0;
+  memset(g_lastState, 0xFF, sizeof(g_lastState));
+}
+
+void tearDown()
+{
+}
+
+EventQueue createQueue()
+{
+  return EventQueue((1 << CONTACT) | (1 << SWITCH), (1 << SECURITY));
+}
+
+void test_coalesces_bistable_inputs()
+{
+  EventQueue queue = createQueue();
+
+  for (uint8_t i = 0; i < 10; i++)
+  {
+    queue.push(1, CONTACT, i & 1);
+  }
+
+  TEST_ASSERT_EQUAL_UINT8(1, queue.getCount());
+  TEST_ASSERT_EQUAL_UINT32(9, queue.getCoalesced());
+
+  // Only the latest state is published
+  TEST_ASSERT_EQUAL_UINT8(1, queue.drain(DRAIN_PER_LOOP, publish));
+  TEST_ASSERT_EQUAL_UINT8(1, g_lastState[1]);
+}
+
+void test_keeps_every_button_event()
+{
+  EventQueue queue = createQueue();
+
+  queue.push(1, BUTTON, 1);
+  queue.push(1, BUTTON, 2);
+
+  TEST_ASSERT_EQUAL_UINT8(2, queue.getCount());
+  TEST_ASSERT_EQUAL_UINT32(0, queue.getCoalesced());
+}
+
+void test_security_events_displace_others()
+{
+  EventQueue queue = createQueue();
+
+  for (uint8_t i = 0; i < EVENT_QUEUE_SIZE; i++)
+  {
+    queue.push(1, BUTTON, 1);
+  }
+
+  // Unprotected events are dropped when full
+  queue.push(2, BUTTON, 1);
+  TEST_ASSERT_EQUAL_UINT8(EVENT_QUEUE_SIZE, queue.getCount());
+  TEST_ASSERT_EQUAL_UINT32(1, queue.getDropped());
+
+  // Security events take the place of the oldest unprotected event
+  queue.push(3, SECURITY, 1);
+  TEST_ASSERT_EQUAL_UINT8(EVENT_QUEUE_SIZE, queue.getCount());
+  TEST_ASSERT_EQUAL_UINT32(2, queue.getDropped());
+
+  while (queue.getCount() > 0)
+  {
+    queue.drain(DRAIN_PER_LOOP, publish);
+  }
+  TEST_ASSERT_EQUAL_UINT16(1, g_securityPublished);
+  TEST_ASSERT_EQUAL_UINT32(0, queue.getProtectedDropped());
+}
+
+void test_security_events_dropped_when_all_security()
+{
+  EventQueue queue = createQueue();
+
+  for (uint8_t i = 0; i < EVENT_QUEUE_SIZE; i++)
+  {
+    queue.push(1, SECURITY, i & 1);
+  }
+
+  // Nothing left to displace, so it has to go, but is counted separately
+  queue.push(2, SECURITY, 1);
+  TEST_ASSERT_EQUAL_UINT8(EVENT_QUEUE_SIZE, queue.getCount());
+  TEST_ASSERT_EQUAL_UINT32(0, queue.getDropped());
+  TEST_ASSERT_EQUAL_UINT32(1, queue.getProtectedDropped());
+}
+
+void test_deferred_events_counted_once()
+{
+  EventQueue queue = createQueue();
+
+  for (uint8_t i = 0; i < DRAIN_PER_LOOP + 2; i++)
+  {
+    queue.push(1, BUTTON, 1);
+  }
+
+  // Two events wait for the next drain, however many drains they wait for
+  queue.drain(DRAIN_PER_LOOP, publish);
+  TEST_ASSERT_EQUAL_UINT32(2, queue.getDeferred());
+  queue.drain(0, publish);
+  TEST_ASSERT_EQUAL_UINT32(2, queue.getDeferred());
+  queue.drain(DRAIN_PER_LOOP, publish);
+  TEST_ASSERT_EQUAL_UINT32(2, queue.getDeferred());
+  TEST_ASSERT_EQUAL_UINT8(0, queue.getCount());
+}
+
+void test_held_events_keep_their_order()
+{
+  EventQueue queue = createQueue();
+
+  queue.push(1, BUTTON, 1);
+  queue.push(2, BUTTON, 1);
+  queue.push(1, BUTTON, 2);
+  queue.push(3, BUTTON, 1);
+
+  // Other inputs are published past the held ones
+  TEST_ASSERT_EQUAL_UINT8(2, queue.drain(DRAIN_PER_LOOP, publishHoldingInput1));
+  TEST_ASSERT_EQUAL_UINT8(1, g_lastState[2]);
+  TEST_ASSERT_EQUAL_UINT8(1, g_lastState[3]);
+  TEST_ASSERT_EQUAL_UINT8(2, queue.getCount());
+
+  // And the held ones come out in the order they happened
+  TEST_ASSERT_EQUAL_UINT8(1, queue.drain(1, publish));
+  TEST_ASSERT_EQUAL_UINT8(1, g_lastState[1]);
+  TEST_ASSERT_EQUAL_UINT8(1, queue.drain(1, publish));
+  TEST_ASSERT_EQUAL_UINT8(2, g_lastState[1]);
+}
+
+void test_storm_is_bounded()
+{
+  EventQueue queue = createQueue();
+
+  // A whole floor powering up, every input chattering for 50 loops. Every
+  // 4th input is a security input, and every 16th a button
+  uint16_t securityPushed = 0;
+  uint32_t maxLoopUs = 0;
+
+  for (uint16_t loop = 0; loop < 50; loop++)
+  {
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint8_t index = 1; index <= INPUT_COUNT; index++)
+    {
+      uint8_t type = (index % 4 == 0) ? SECURITY : (index % 16 == 1) ? BUTTON : (index & 1) ? CONTACT : SWITCH;
+      if (type == SECURITY && loop % 10 != 0)
+        continue;
+
+      queue.push(index, type, loop & 1);
+      if (type == SECURITY)
+      {
+        securityPushed++;
+      }
+    }
+
+    uint16_t published = g_published;
+    queue.drain(DRAIN_PER_LOOP, publish);
+
+    // Work per loop is bounded, however many events are waiting
+    TEST_ASSERT_LESS_OR_EQUAL_UINT16(DRAIN_PER_LOOP, g_published - published);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT8(EVENT_QUEUE_SIZE, queue.getCount());
+
+    uint32_t loopUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    if (loopUs > maxLoopUs)
+    {
+      maxLoopUs = loopUs;
+    }
+  }
+
+  // Generous, a loop is a few thousand compares on the host
+  TEST_ASSERT_LESS_THAN_UINT32(10000, maxLoopUs);
+
+  // Once the storm is over the queue drains in a fixed number of loops
+  uint16_t loops = 0;
+  while (queue.getCount() > 0)
+  {
+    queue.drain(DRAIN_PER_LOOP, publish);
+    loops++;
+  }
+  TEST_ASSERT_LESS_OR_EQUAL_UINT16(EVENT_QUEUE_SIZE / DRAIN_PER_LOOP, loops);
+
+  // Bi-stable inputs end up with their final state, security events are all
+  // published and everything was accounted for
+  TEST_ASSERT_EQUAL_UINT8(1, g_lastState[3]);
+  TEST_ASSERT_EQUAL_UINT8(1, g_lastState[6]);
+  TEST_ASSERT_EQUAL_UINT16(securityPushed, g_securityPublished);
+  TEST_ASSERT_GREATER_THAN_UINT32(0, queue.getCoalesced());
+  TEST_ASSERT_GREATER_THAN_UINT32(0, queue.getDeferred());
+  TEST_ASSERT_LESS_OR_EQUAL_UINT8(EVENT_QUEUE_SIZE, queue.getHighWater());
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_coalesces_bistable_inputs);
+  RUN_TEST(test_keeps_every_button_event);
+  RUN_TEST(test_security_events_displace_others);
+  RUN_TEST(test_security_events_dropped_when_all_security);
+  RUN_TEST(test_deferred_events_counted_once);
+  RUN_TEST(test_held_events_keep_their_order);
+  RUN_TEST(test_storm_is_bounded);
+  return UNITY_END();
+}
@@ -0,0 +1,326 @@
+/**
+  Host tests for KNX Data Secure (pio test -e native)
+
+  Known answers:
+    - AES-128 from FIPS-197 appendix C.1, through the same key schedule
+    - CCM from NIST SP 800-38C appendix C (examples 1 and 2), with standard
+      CCM B0/Ctr0 blocks fed through the same CBC-MAC and CTR code, which
+      checks associated data encoding/padding, counter order and the MAC
+      truncation to 4 bytes (no published KNX vectors were to hand, so the
+      KNX specific B0/Ctr0 layout is only checked against the spec layout)
+    - B0/Ctr0 layout as described in KnxSecure.cpp
+    - CBC-MAC, CTR and full S-A_Data values computed independently (AES from
+      OpenSSL, CCM steps in Python) for key 000102..0F, sequence 1, source
+      1.1.244 and target 1/0/1
+
+  Copyright 2023 Ben Jones <ben.jones12@gmail.com>
+*/
+
+#include <unity.h>
+#include "KnxSecure.h"
+
+// Access to the CCM building blocks
+class KnxSecureTest
+{
+  public:
+    static void aes(KnxSecure & secure, uint8_t keySlot, const uint8_t in[16], uint8_t out[16])
+    {
+      mbedtls_aes_crypt_ecb(&secure._aes[keySlot - 1], MBEDTLS_AES_ENCRYPT, in, out);
+    }
+
+    static void block0(KnxSecure & secure, uint8_t block[16], const uint8_t * sequence, uint16_t source, uint16_t target, uint8_t payloadLength)
+    {
+      secure._block0(block, sequence, source, target, payloadLength);
+    }
+
+    static void counter0(KnxSecure & secure, uint8_t block[16], const uint8_t * sequence, uint16_t source, uint16_t target)
+    {
+      secure._counter0(block, sequence, source, target);
+    }
+
+    static void cbcMac(KnxSecure & secure, uint8_t keySlot, const uint8_t block0[16], const uint8_t * data, uint8_t dataLength, const uint8_t * payload, uint8_t payloadLength, uint8_t mac[16])
+    {
+      secure._cbcMac(&secure._aes[keySlot - 1], block0, data, dataLength, payload, payloadLength, mac);
+    }
+
+    static void ctr(KnxSecure & secure, uint8_t keySlot, const uint8_t counter0[16], const uint8_t * in, uint8_t length, uint8_t * out, uint8_t * mac)
+    {
+      secure._ctr(&secure._aes[keySlot - 1], counter0, in, length, out, mac);
+    }
+};
+
+#define       SOURCE                0x11F4      // 1.1.244
+#define       TARGET                0x0801      // 1/0/1
+
+const uint8_t KEY[KNX_SECURE_KEY_LENGTH]  = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F };
+const uint8_t SEQUENCE[KNX_SECURE_SEQ_LENGTH] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 };
+
+// A_GroupValue_Write, on
+const uint8_t APDU[]                = { 0x00, 0x81 };
+
+const uint8_t BLOCK0[16]            = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x11, 0xF4, 0x08, 0x01, 0x00, 0x80, 0x03, 0xF1, 0x00, 0x02 };
+const uint8_t COUNTER0[16]          = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x11, 0xF4, 0x08, 0x01, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00 };
+
+// 0x20..0x33, spans two payload blocks
+const uint8_t PAYLOAD_CBC_MAC[16]   = { 0x73, 0xF8, 0xE3, 0xDC, 0xB7, 0x3A, 0xB9, 0xBF, 0xA4, 0xDE, 0xCD, 0xDD, 0x9A, 0xDC, 0x8A, 0x31 };
+const uint8_t PAYLOAD_CTR[20]       = { 0x77, 0xDE, 0x3A, 0xD2, 0x0B, 0x3A, 0x64, 0x8C, 0x74, 0x3F, 0xD6, 0x35, 0xB9, 0xBB, 0xF2, 0xF6, 0x39, 0x45, 0x2A, 0xD1 };
+const uint8_t COUNTER0_STREAM[4]    = { 0xE7, 0xC9, 0xA1, 0x3B };
+
+// APCI, SCF, sequence number, encrypted APDU and MAC
+const uint8_t SECURE_APDU[]         = { 0x03, 0xF1, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x57, 0x7E, 0x6A, 0x49, 0x72, 0x55 };
+
+void setUp()
+{
+  // Start each test from empty NVS
+  Preferences nvs;
+  nvs.begin("knxsecure");
+  nvs.clear();
+}
+
+void tearDown()
+{
+}
+
+void test_aes_fips197()
+{
+  KnxSecure secure;
+  uint8_t keySlot = secure.addKey(KEY);
+
+  const uint8_t plain[16]    = { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF };
+  const uint8_t expected[16] = { 0x69, 0xC4, 0xE0, 0xD8, 0x6A, 0x7B, 0x04, 0x30, 0xD8, 0xCD, 0xB7, 0x80, 0x70, 0xB4, 0xC5, 0x5A };
+
+  uint8_t cipher[16];
+  KnxSecureTest::aes(secure, keySlot, plain, cipher);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, cipher, 16);
+}
+
+void test_block0_layout()
+{
+  KnxSecure secure;
+
+  uint8_t block[16];
+  KnxSecureTest::block0(secure, block, SEQUENCE, SOURCE, TARGET, sizeof(APDU));
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(BLOCK0, block, 16);
+}
+
+void test_counter0_layout()
+{
+  KnxSecure secure;
+
+  uint8_t block[16];
+  KnxSecureTest::counter0(secure, block, SEQUENCE, SOURCE, TARGET);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(COUNTER0, block, 16);
+}
+
+void test_cbc_mac()
+{
+  KnxSecure secure;
+  uint8_t keySlot = secure.addKey(KEY);
+
+  uint8_t payload[20];
+  for (uint8_t i = 0; i < sizeof(payload); i++) { payload[i] = 0x20 + i; }
+
+  uint8_t scf = KNX_SECURE_SCF_AUTH_CONF;
+  uint8_t mac[16];
+  KnxSecureTest::cbcMac(secure, keySlot, BLOCK0, &scf, sizeof(scf), payload, sizeof(payload), mac);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(PAYLOAD_CBC_MAC, mac, 16);
+}
+
+void checkCcm(const uint8_t block0[16], const uint8_t counter0[16], const uint8_t * data, uint8_t dataLength, const uint8_t * payload, uint8_t payloadLength, const uint8_t * expected)
+{
+  const uint8_t key[KNX_SECURE_KEY_LENGTH] = { 0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4A, 0x4B, 0x4C, 0x4D, 0x4E, 0x4F };
+
+  KnxSecure secure;
+  uint8_t keySlot = secure.addKey(key);
+
+  uint8_t mac[16];
+  uint8_t out[16];
+  KnxSecureTest::cbcMac(secure, keySlot, block0, data, dataLength, payload, payloadLength, mac);
+  KnxSecureTest::ctr(secure, keySlot, counter0, payload, payloadLength, out, mac);
+
+  // Ciphertext, then the MAC (the published MAC truncated to our length)
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, out, payloadLength);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(&expected[payloadLength], mac, KNX_SECURE_MAC_LENGTH);
+}
+
+void test_ccm_sp800_38c_example1()
+{
+  // Nonce 10..16, 8 bytes of associated data, 4 byte payload, 4 byte MAC
+  const uint8_t block0[16]   = { 0x4F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04 };
+  const uint8_t counter0[16] = { 0x07, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+  const uint8_t data[8]      = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07 };
+  const uint8_t payload[4]   = { 0x20, 0x21, 0x22, 0x23 };
+  const uint8_t expected[8]  = { 0x71, 0x62, 0x01, 0x5B, 0x4D, 0xAC, 0x25, 0x5D };
+
+  checkCcm(block0, counter0, data, sizeof(data), payload, sizeof(payload), expected);
+}
+
+void test_ccm_sp800_38c_example2()
+{
+  // Nonce 10..17, 16 bytes of associated data (spills into a second block),
+  // 16 byte payload, 6 byte MAC (of which we check our 4)
+  const uint8_t block0[16]   = { 0x56, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10 };
+  const uint8_t counter0[16] = { 0x06, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+  const uint8_t data[16]     = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F };
+  const uint8_t payload[16]  = { 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F };
+  const uint8_t expected[22] = { 0xD2, 0xA1, 0xF0, 0xE0, 0x51, 0xEA, 0x5F, 0x62, 0x08, 0x1A, 0x77, 0x92, 0x07, 0x3D, 0x59, 0x3D,
+                                 0x1F, 0xC6, 0x4F, 0xBF, 0xAC, 0xCD };
+
+  checkCcm(block0, counter0, data, sizeof(data), payload, sizeof(payload), expected);
+}
+
+void test_ctr()
+{
+  KnxSecure secure;
+  uint8_t keySlot = secure.addKey(KEY);
+
+  uint8_t payload[20];
+  for (uint8_t i = 0; i < sizeof(payload); i++) { payload[i] = 0x20 + i; }
+
+  // Counter 0 masks the MAC, the payload starts at counter 1
+  uint8_t out[20];
+  uint8_t mac[16];
+  memset(mac, 0, sizeof(mac));
+  KnxSecureTest::ctr(secure, keySlot, COUNTER0, payload, sizeof(payload), out, mac);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(PAYLOAD_CTR, out, sizeof(out));
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(COUNTER0_STREAM, mac, sizeof(COUNTER0_STREAM));
+}
+
+void test_encrypt()
+{
+  // First sequence number from empty NVS is 1
+  KnxSecure secure;
+  secure.begin();
+  uint8_t keySlot = secure.addKey(KEY);
+
+  uint8_t secureApdu[KNX_SECURE_OVERHEAD + sizeof(APDU)];
+  TEST_ASSERT_EQUAL_UINT8(sizeof(SECURE_APDU), secure.encrypt(keySlot, SOURCE, TARGET, APDU, sizeof(APDU), secureApdu));
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(SECURE_APDU, secureApdu, sizeof(SECURE_APDU));
+}
+
+void test_decrypt_and_replay()
+{
+  KnxSecure secure;
+  secure.begin();
+  uint8_t keySlot = secure.addKey(KEY);
+
+  uint8_t apdu[KNX_SECURE_APDU_MAX];
+  TEST_ASSERT_EQUAL_UINT8(sizeof(APDU), secure.decrypt(keySlot, SOURCE, TARGET, SECURE_APDU, sizeof(SECURE_APDU), apdu));
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(APDU, apdu, sizeof(APDU));
+
+  // The same telegram again is a replay
+  TEST_ASSERT_EQUAL_UINT8(0, secure.decrypt(keySlot, SOURCE, TARGET, SECURE_APDU, sizeof(SECURE_APDU), apdu));
+  TEST_ASSERT_EQUAL_UINT32(1, secure.getReplayFailures());
+
+  // Any change to the telegram fails the MAC
+  uint8_t tampered[sizeof(SECURE_APDU)];
+  memcpy(tampered, SECURE_APDU, sizeof(tampered));
+  tampered[9] ^= 0x01;
+  TEST_ASSERT_EQUAL_UINT8(0, secure.decrypt(keySlot, SOURCE, TARGET, tampered, sizeof(tampered), apdu));
+  TEST_ASSERT_EQUAL_UINT32(1, secure.getMacFailures());
+}
+
+void test_replay_rejected_after_reboot()
+{
+  uint8_t apdu[KNX_SECURE_APDU_MAX];
+
+  {
+    KnxSecure secure;
+    secure.begin();
+    uint8_t keySlot = secure.addKey(KEY);
+    TEST_ASSERT_EQUAL_UINT8(sizeof(APDU), secure.decrypt(keySlot, SOURCE, TARGET, SECURE_APDU, sizeof(SECURE_APDU), apdu));
+  }
+
+  // Straight after a reboot, the telegram we just accepted is still a replay
+  KnxSecure rebooted;
+  rebooted.begin();
+  uint8_t keySlot = rebooted.addKey(KEY);
+  TEST_ASSERT_EQUAL_UINT8(0, rebooted.decrypt(keySlot, SOURCE, TARGET, SECURE_APDU, sizeof(SECURE_APDU), apdu));
+  TEST_ASSERT_EQUAL_UINT32(1, rebooted.getReplayFailures());
+}
+
+void test_key_slots_are_released()
+{
+  KnxSecure secure;
+  uint8_t key[KNX_SECURE_KEY_LENGTH];
+  memcpy(key, KEY, sizeof(key));
+
+  for (uint8_t i = 0; i < KNX_SECURE_KEY_COUNT; i++)
+  {
+    key[0] = i;
+    TEST_ASSERT_EQUAL_UINT8(i + 1, secure.addKey(key));
+  }
+
+  // Full, but the same key can be shared
+  key[0] = 0xFF;
+  TEST_ASSERT_EQUAL_UINT8(0, secure.addKey(key));
+  key[0] = 0x01;
+  TEST_ASSERT_EQUAL_UINT8(2, secure.addKey(key));
+
+  // Shared keys are only freed once nothing uses them
+  secure.removeKey(2);
+  key[0] = 0xFF;
+  TEST_ASSERT_EQUAL_UINT8(0, secure.addKey(key));
+
+  secure.removeKey(2);
+  TEST_ASSERT_EQUAL_UINT8(2, secure.addKey(key));
+
+  // A freed slot can't be used to encrypt
+  uint8_t secureApdu[KNX_SECURE_OVERHEAD + sizeof(APDU)];
+  secure.removeKey(1);
+  TEST_ASSERT_EQUAL_UINT8(0, secure.encrypt(1, SOURCE, TARGET, APDU, sizeof(APDU), secureApdu));
+}
+
+void test_full_peer_table_rejects_new_senders()
+{
+  KnxSecure sender;
+  sender.begin();
+  uint8_t senderSlot = sender.addKey(KEY);
+
+  KnxSecure receiver;
+  receiver.begin();
+  uint8_t receiverSlot = receiver.addKey(KEY);
+
+  uint8_t secureApdu[KNX_SECURE_OVERHEAD + sizeof(APDU)];
+  uint8_t firstApdu[KNX_SECURE_OVERHEAD + sizeof(APDU)];
+  uint8_t apdu[KNX_SECURE_APDU_MAX];
+  uint8_t length;
+
+  for (uint16_t source = 1; source <= KNX_SECURE_PEER_COUNT; source++)
+  {
+    length = sender.encrypt(senderSlot, source, TARGET, APDU, sizeof(APDU), secureApdu);
+    TEST_ASSERT_EQUAL_UINT8(sizeof(APDU), receiver.decrypt(receiverSlot, source, TARGET, secureApdu, length, apdu));
+
+    if (source == 1)
+    {
+      memcpy(firstApdu, secureApdu, length);
+    }
+  }
+
+  // No room to track another sender, so reject rather than forget one
+  length = sender.encrypt(senderSlot, KNX_SECURE_PEER_COUNT + 1, TARGET, APDU, sizeof(APDU), secureApdu);
+  TEST_ASSERT_EQUAL_UINT8(0, receiver.decrypt(receiverSlot, KNX_SECURE_PEER_COUNT + 1, TARGET, secureApdu, length, apdu));
+  TEST_ASSERT_EQUAL_UINT32(1, receiver.getPeerOverflows());
+
+  // Every known sender is still protected against replays
+  TEST_ASSERT_EQUAL_UINT8(0, receiver.decrypt(receiverSlot, 1, TARGET, firstApdu, length, apdu));
+  TEST_ASSERT_EQUAL_UINT32(1, receiver.getReplayFailures());
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_aes_fips197);
+  RUN_TEST(test_block0_layout);
+  RUN_TEST(test_counter0_layout);
+  RUN_TEST(test_cbc_mac);
+  RUN_TEST(test_ctr);
+  RUN_TEST(test_ccm_sp800_38c_example1);
+  RUN_TEST(test_ccm_sp800_38c_example2);
+  RUN_TEST(test_encrypt);
+  RUN_TEST(test_decrypt_and_replay);
+  RUN_TEST(test_replay_rejected_after_reboot);
+  RUN_TEST(test_key_slots_are_released);
+  RUN_TEST(test_full_peer_table_rejects_new_senders);
+  return UNITY_END();
+}
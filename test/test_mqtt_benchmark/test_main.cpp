@@ -0,0 +1,334 @@
+/**
+  Host MQTT publish benchmark (pio test -e native-benchmark -v)
+
+  Drives PubSubClient over loopback to a local mosquitto (started here, so
+  it needs to be on the PATH) with the same MqttBenchmark pacing and
+  MqttStats accounting loopBenchmark() uses on the device. For each phase
+  it reports sustained throughput, how many events a second client
+  subscribed to the topic received, the publish latency histogram and the
+  longest loop, with the broker running or throttled (stopped for part of
+  every period).
+
+  This only measures PubSubClient and mosquitto on the host, not the
+  device's network stack, so it reports numbers rather than asserting on
+  them (the pacing and accounting are unit tested in test_mqtt_stats).
+
+  Copyright 2023 Ben Jones <ben.jones12@gmail.com>
+*/
+
+#include <unity.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <PubSubClient.h>
+#include "PosixClient.h"
+#include "MqttStats.h"
+
+#define       BROKER_HOST               "127.0.0.1"
+#define       BROKER_PORT               18830
+#define       BROKER_CONFIG             "/tmp/oxrs-benchmark-mosquitto.conf"
+#define       BROKER_START_MS           5000
+
+#define       BENCHMARK_TOPIC           "stat/benchmark/benchmark"
+
+// Per loop limit must match src/main.cpp, the rate goes beyond the firmware
+// limit (1000/s) to find where it saturates
+#define       MQTT_BENCHMARK_MAX_RATE   10000
+#define       MQTT_BENCHMARK_MAX_MS     60000
+#define       MQTT_BENCHMARK_PER_LOOP   10
+
+// ESP32 lwIP TCP send buffer, and roughly how long its clients block on write
+#define       CLIENT_SEND_BUFFER        5744
+#define       CLIENT_WRITE_TIMEOUT_MS   5000
+
+#define       MQTT_KEEP_ALIVE_S         5
+#define       MQTT_RECONNECT_MS         1000
+
+// How long to wait for in-flight events after each phase
+#define       DRAIN_MS                  500
+
+// Throttled broker is stopped for this long every period
+#define       THROTTLE_PERIOD_MS        100
+#define       THROTTLE_STOPPED_MS       50
+
+enum brokerMode_t { BROKER_RUNNING, BROKER_THROTTLED };
+
+struct BenchmarkPhase
+{
+  const char * name;
+  uint16_t rate;
+  uint32_t durationMs;
+  brokerMode_t mode;
+};
+
+struct BenchmarkResult
+{
+  uint32_t received;
+  uint32_t maxLoopUs;
+  uint32_t disconnects;
+};
+
+extern char ** environ;
+
+pid_t g_broker = 0;
+bool g_brokerStopped = false;
+
+uint32_t g_received = 0;
+
+PosixClient publisherClient(CLIENT_SEND_BUFFER, CLIENT_WRITE_TIMEOUT_MS);
+PosixClient subscriberClient(65536, CLIENT_WRITE_TIMEOUT_MS);
+PubSubClient publisher(publisherClient);
+PubSubClient subscriber(subscriberClient);
+
+MqttStats mqttStats;
+MqttBenchmark mqttBenchmark(MQTT_BENCHMARK_MAX_RATE, MQTT_BENCHMARK_MAX_MS, MQTT_BENCHMARK_PER_LOOP);
+
+/**
+  Broker
+ */
+bool startBroker()
+{
+  FILE * config = fopen(BROKER_CONFIG, "w");
+  if (config == NULL)
+    return false;
+
+  fprintf(config, "listener %d %s\nallow_anonymous true\npersistence false\nlog_dest none\n", BROKER_PORT, BROKER_HOST);
+  fclose(config);
+
+  char * argv[] = { (char *)"mosquitto", (char *)"-c", (char *)BROKER_CONFIG, NULL };
+  if (posix_spawnp(&g_broker, "mosquitto", NULL, NULL, argv, environ) != 0)
+  {
+    g_broker = 0;
+    return false;
+  }
+
+  // Wait for it to start listening
+  PosixClient probe(CLIENT_SEND_BUFFER, CLIENT_WRITE_TIMEOUT_MS);
+  uint32_t startMs = millis();
+  while (millis() - startMs < BROKER_START_MS)
+  {
+    if (probe.connect(BROKER_HOST, BROKER_PORT))
+      return true;
+
+    delay(50);
+  }
+
+  return false;
+}
+
+void stopBroker()
+{
+  if (g_broker == 0)
+    return;
+
+  kill(g_broker, SIGCONT);
+  kill(g_broker, SIGTERM);
+  waitpid(g_broker, NULL, 0);
+  g_broker = 0;
+}
+
+void setBrokerStopped(bool stopped)
+{
+  if (stopped != g_brokerStopped)
+  {
+    kill(g_broker, stopped ? SIGSTOP : SIGCONT);
+    g_brokerStopped = stopped;
+  }
+}
+
+void controlBroker(const BenchmarkPhase & phase, uint32_t elapsedMs)
+{
+  switch (phase.mode)
+  {
+    case BROKER_THROTTLED:
+      setBrokerStopped(elapsedMs % THROTTLE_PERIOD_MS < THROTTLE_STOPPED_MS);
+      break;
+
+    default:
+      setBrokerStopped(false);
+      break;
+  }
+}
+
+/**
+  MQTT
+ */
+void callback(char * topic, uint8_t * payload, unsigned int length)
+{
+  g_received++;
+}
+
+bool connectPublisher()
+{
+  return publisher.connect("benchmark-publisher");
+}
+
+bool connectSubscriber()
+{
+  return subscriber.connect("benchmark-subscriber") && subscriber.subscribe(BENCHMARK_TOPIC);
+}
+
+void loopClient(PubSubClient & client, bool (*connect)(), uint32_t & lastConnectMs)
+{
+  if (client.connected())
+  {
+    client.loop();
+    return;
+  }
+
+  // Same back off as the firmware's MQTT reconnect
+  if (millis() - lastConnectMs >= MQTT_RECONNECT_MS)
+  {
+    lastConnectMs = millis();
+    connect();
+  }
+}
+
+// Same payload and accounting as publishBenchmark() in src/main.cpp
+bool publishBenchmark(uint32_t sequence)
+{
+  char payload[64];
+  snprintf(payload, sizeof(payload), "{\"type\":\"benchmark\",\"sequence\":%u}", sequence);
+
+  uint32_t startUs = micros();
+  bool success = publisher.publish(BENCHMARK_TOPIC, payload);
+  mqttStats.record(success, micros() - startUs);
+
+  return success;
+}
+
+/**
+  Benchmark
+ */
+BenchmarkResult runPhase(const BenchmarkPhase & phase)
+{
+  BenchmarkResult result = {};
+  g_received = 0;
+
+  uint32_t publisherConnectMs = millis();
+  uint32_t subscriberConnectMs = millis();
+  bool wasConnected = publisher.connected();
+
+  uint32_t startMs = millis();
+  mqttStats.resetPeriod();
+  mqttBenchmark.start(phase.rate, phase.durationMs, startMs);
+
+  while (mqttBenchmark.isRunning())
+  {
+    uint32_t loopStartUs = micros();
+
+    controlBroker(phase, millis() - startMs);
+    mqttBenchmark.loop(millis(), publishBenchmark);
+
+    loopClient(publisher, connectPublisher, publisherConnectMs);
+    loopClient(subscriber, connectSubscriber, subscriberConnectMs);
+
+    if (wasConnected && !publisher.connected())
+    {
+      result.disconnects++;
+    }
+    wasConnected = publisher.connected();
+
+    result.maxLoopUs = std::max(result.maxLoopUs, (uint32_t)(micros() - loopStartUs));
+  }
+
+  // Let the broker catch up and deliver whatever is still in flight
+  setBrokerStopped(false);
+
+  uint32_t drainMs = millis();
+  while (millis() - drainMs < DRAIN_MS)
+  {
+    loopClient(publisher, connectPublisher, publisherConnectMs);
+    loopClient(subscriber, connectSubscriber, subscriberConnectMs);
+  }
+
+  result.received = g_received;
+  return result;
+}
+
+void printHeader()
+{
+  printf("\n%-10s %6s %7s %7s %7s %9s %9s %8s %8s %8s %8s %8s %10s %10s %5s\n",
+    "phase", "rate", "sent", "failed", "recv", "sent/s", "recv/s",
+    "<1ms", "<5ms", "<20ms", "<100ms", ">=100ms", "maxPubUs", "maxLoopUs", "disc");
+}
+
+void printResult(const BenchmarkPhase & phase, const BenchmarkResult & result)
+{
+  printf("%-10s %6u %7u %7u %7u %9.1f %9.1f",
+    phase.name, mqttBenchmark.getRate(), mqttBenchmark.getSent(), mqttBenchmark.getFailed(), result.received,
+    mqttBenchmark.getSustainedRate(),
+    (float)result.received * 1000 / mqttBenchmark.getElapsedMs());
+
+  for (uint8_t i = 0; i < MQTT_LATENCY_BUCKETS; i++)
+  {
+    printf(" %8u", mqttStats.getLatency(i));
+  }
+
+  printf(" %10u %10u %5u\n", mqttStats.getMaxLatencyUs(), result.maxLoopUs, result.disconnects);
+}
+
+/**
+  Tests
+ */
+void setUp()
+{
+  TEST_ASSERT_TRUE_MESSAGE(g_broker != 0, "mosquitto failed to start, is it on the PATH?");
+
+  uint32_t startMs = millis();
+  while (!(publisher.connected() && subscriber.connected()) && millis() - startMs < BROKER_START_MS)
+  {
+    if (!publisher.connected()) connectPublisher();
+    if (!subscriber.connected()) connectSubscriber();
+  }
+  TEST_ASSERT_TRUE(publisher.connected());
+  TEST_ASSERT_TRUE(subscriber.connected());
+}
+
+void test_sustained_throughput()
+{
+  const uint16_t rates[] = { 100, 250, 500, 1000, 2000, 5000, 10000 };
+
+  printHeader();
+  for (uint16_t rate : rates)
+  {
+    BenchmarkPhase phase = { "sustained", rate, 3000, BROKER_RUNNING };
+    printResult(phase, runPhase(phase));
+  }
+}
+
+void test_throttled_broker()
+{
+  const uint16_t rates[] = { 100, 1000 };
+
+  printHeader();
+  for (uint16_t rate : rates)
+  {
+    BenchmarkPhase phase = { "throttled", rate, 5000, BROKER_THROTTLED };
+    printResult(phase, runPhase(phase));
+  }
+}
+
+int main(int argc, char **argv)
+{
+  publisher.setServer(BROKER_HOST, BROKER_PORT);
+  publisher.setKeepAlive(MQTT_KEEP_ALIVE_S);
+
+  subscriber.setServer(BROKER_HOST, BROKER_PORT);
+  subscriber.setKeepAlive(MQTT_KEEP_ALIVE_S);
+  subscriber.setCallback(callback);
+
+  if (!startBroker())
+  {
+    stopBroker();
+  }
+
+  UNITY_BEGIN();
+  RUN_TEST(test_sustained_throughput);
+  RUN_TEST(test_throttled_broker);
+  int failures = UNITY_END();
+
+  stopBroker();
+  return failures;
+}
@@ -0,0 +1,157 @@
+/**
+  Host tests for MQTT publish accounting and benchmark pacing (pio test -e native)
+
+  Copyright 2023 Ben Jones <ben.jones12@gmail.com>
+*/
+
+#include <unity.h>
+#include "MqttStats.h"
+
+#define       MAX_RATE              1000
+#define       MAX_MS                60000
+#define       PER_LOOP              10
+
+// Publishes seen by the benchmark publisher
+uint32_t g_published = 0;
+uint32_t g_lastSequence = 0;
+bool     g_failPublish = false;
+
+bool publish(uint32_t sequence)
+{
+  g_published++;
+  g_lastSequence = sequence;
+  return !g_failPublish;
+}
+
+void setUp()
+{
+  g_published = 0;
+  g_lastSequence = 0;
+  g_failPublish = false;
+}
+
+void tearDown()
+{
+}
+
+void test_latency_buckets()
+{
+  MqttStats stats;
+
+  // Each bucket is an exclusive upper bound, the last one is open
+  stats.record(true, 0);
+  stats.record(true, 999);
+  stats.record(true, 1000);
+  stats.record(true, 19999);
+  stats.record(false, 100000);
+  stats.record(false, 5000000);
+
+  TEST_ASSERT_EQUAL_UINT32(2, stats.getLatency(0));
+  TEST_ASSERT_EQUAL_UINT32(1, stats.getLatency(1));
+  TEST_ASSERT_EQUAL_UINT32(1, stats.getLatency(2));
+  TEST_ASSERT_EQUAL_UINT32(0, stats.getLatency(3));
+  TEST_ASSERT_EQUAL_UINT32(2, stats.getLatency(MQTT_LATENCY_BUCKETS - 1));
+  TEST_ASSERT_EQUAL_UINT32(4, stats.getPublished());
+  TEST_ASSERT_EQUAL_UINT32(2, stats.getFailed());
+  TEST_ASSERT_EQUAL_UINT32(5000000, stats.getMaxLatencyUs());
+}
+
+void test_reset_period_keeps_counts()
+{
+  MqttStats stats;
+
+  stats.record(true, 30000);
+  stats.record(false, 300);
+  stats.resetPeriod();
+
+  for (uint8_t i = 0; i < MQTT_LATENCY_BUCKETS; i++)
+  {
+    TEST_ASSERT_EQUAL_UINT32(0, stats.getLatency(i));
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, stats.getMaxLatencyUs());
+  TEST_ASSERT_EQUAL_UINT32(1, stats.getPublished());
+  TEST_ASSERT_EQUAL_UINT32(1, stats.getFailed());
+}
+
+void test_benchmark_paces_to_rate()
+{
+  MqttBenchmark benchmark(MAX_RATE, MAX_MS, PER_LOOP);
+
+  // 100/s for 1s, looping every ms never needs more than one per loop
+  benchmark.start(100, 1000, 5000);
+  TEST_ASSERT_TRUE(benchmark.isRunning());
+
+  uint32_t nowMs = 5000;
+  while (!benchmark.loop(nowMs, publish))
+  {
+    nowMs++;
+  }
+
+  TEST_ASSERT_FALSE(benchmark.isRunning());
+  TEST_ASSERT_EQUAL_UINT32(6000, nowMs);
+  TEST_ASSERT_EQUAL_UINT32(1000, benchmark.getElapsedMs());
+  TEST_ASSERT_EQUAL_UINT32(99, benchmark.getSent());
+  TEST_ASSERT_EQUAL_UINT32(99, g_published);
+  TEST_ASSERT_EQUAL_UINT32(98, g_lastSequence);
+  TEST_ASSERT_EQUAL_UINT16(100, benchmark.getRate());
+  TEST_ASSERT_EQUAL_FLOAT(99.0f, benchmark.getSustainedRate());
+}
+
+void test_benchmark_catches_up_per_loop()
+{
+  MqttBenchmark benchmark(MAX_RATE, MAX_MS, PER_LOOP);
+
+  // A slow loop only catches up so much at a time
+  benchmark.start(1000, 10000, 0);
+  TEST_ASSERT_FALSE(benchmark.loop(100, publish));
+  TEST_ASSERT_EQUAL_UINT32(PER_LOOP, benchmark.getSent());
+  TEST_ASSERT_FALSE(benchmark.loop(101, publish));
+  TEST_ASSERT_EQUAL_UINT32(PER_LOOP * 2, benchmark.getSent());
+
+  // Nothing more is due once it has caught up
+  TEST_ASSERT_FALSE(benchmark.loop(20, publish));
+  TEST_ASSERT_EQUAL_UINT32(PER_LOOP * 2, benchmark.getSent());
+}
+
+void test_benchmark_clamps_and_ignores_zero()
+{
+  MqttBenchmark benchmark(MAX_RATE, MAX_MS, PER_LOOP);
+
+  benchmark.start(0, 1000, 0);
+  TEST_ASSERT_FALSE(benchmark.isRunning());
+  benchmark.start(100, 0, 0);
+  TEST_ASSERT_FALSE(benchmark.isRunning());
+  TEST_ASSERT_FALSE(benchmark.loop(1000, publish));
+
+  benchmark.start(5000, 120000, 0);
+  TEST_ASSERT_EQUAL_UINT16(MAX_RATE, benchmark.getRate());
+  TEST_ASSERT_FALSE(benchmark.loop(MAX_MS - 1, publish));
+  TEST_ASSERT_TRUE(benchmark.loop(MAX_MS, publish));
+}
+
+void test_benchmark_counts_failures()
+{
+  MqttBenchmark benchmark(MAX_RATE, MAX_MS, PER_LOOP);
+
+  benchmark.start(1000, 1000, 0);
+  TEST_ASSERT_FALSE(benchmark.loop(5, publish));
+  g_failPublish = true;
+  TEST_ASSERT_FALSE(benchmark.loop(10, publish));
+  TEST_ASSERT_TRUE(benchmark.loop(1000, publish));
+
+  TEST_ASSERT_EQUAL_UINT32(10, benchmark.getSent());
+  TEST_ASSERT_EQUAL_UINT32(5, benchmark.getFailed());
+  TEST_ASSERT_EQUAL_FLOAT(5.0f, benchmark.getSustainedRate());
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_latency_buckets);
+  RUN_TEST(test_reset_period_keeps_counts);
+  RUN_TEST(test_benchmark_paces_to_rate);
+  RUN_TEST(test_benchmark_catches_up_per_loop);
+  RUN_TEST(test_benchmark_clamps_and_ignores_zero);
+  RUN_TEST(test_benchmark_counts_failures);
+  return UNITY_END();
+}